@@ -1,5 +1,6 @@
 #include "LitColorTextureProgram.hpp"
 
+#include "UniformBlocks.hpp"
 #include "gl_compile_program.hpp"
 #include "gl_errors.hpp"
 
@@ -11,17 +12,11 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 	//----- build the pipeline template -----
 	lit_color_texture_program_pipeline.program = ret->program;
 
-	lit_color_texture_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
+	//(no OBJECT_TO_CLIP -- clip position comes from OBJECT_TO_LIGHT and the Camera block's LIGHT_TO_CLIP)
 	lit_color_texture_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
 	lit_color_texture_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
-
-	/* This will be used later if/when we build a light loop into the Scene:
-	lit_color_texture_program_pipeline.LIGHT_TYPE_int = ret->LIGHT_TYPE_int;
-	lit_color_texture_program_pipeline.LIGHT_LOCATION_vec3 = ret->LIGHT_LOCATION_vec3;
-	lit_color_texture_program_pipeline.LIGHT_DIRECTION_vec3 = ret->LIGHT_DIRECTION_vec3;
-	lit_color_texture_program_pipeline.LIGHT_ENERGY_vec3 = ret->LIGHT_ENERGY_vec3;
-	lit_color_texture_program_pipeline.LIGHT_CUTOFF_float = ret->LIGHT_CUTOFF_float;
-	*/
+	lit_color_texture_program_pipeline.LIGHT_INDEX_COUNT_uint = ret->LIGHT_INDEX_COUNT_uint;
+	lit_color_texture_program_pipeline.LIGHT_INDICES_uint_array = ret->LIGHT_INDICES_uint_array;
 
 	//make a 1-pixel white texture to bind by default:
 	GLuint tex;
@@ -43,64 +38,118 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 	return ret;
 });
 
-LitColorTextureProgram::LitColorTextureProgram() {
+Scene::Instanced::Pipeline lit_color_texture_instanced_program_pipeline;
+
+//(n.b. loaded after lit_color_texture_program, since loads with the same tag run in order)
+Load< LitColorTextureProgram > lit_color_texture_instanced_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
+	LitColorTextureProgram *ret = new LitColorTextureProgram(LitColorTextureProgram::Instanced);
+
+	//----- build the pipeline template -----
+	lit_color_texture_instanced_program_pipeline.program = ret->program;
+
+	lit_color_texture_instanced_program_pipeline.OBJECT_TO_WORLD_mat4x3 = ret->OBJECT_TO_WORLD_mat4x3;
+	lit_color_texture_instanced_program_pipeline.LIGHT_INDEX_COUNT_uint = ret->LIGHT_INDEX_COUNT_uint;
+	lit_color_texture_instanced_program_pipeline.LIGHT_INDICES_uint_array = ret->LIGHT_INDICES_uint_array;
+
+	//share the non-instanced template's 1-pixel white texture:
+	lit_color_texture_instanced_program_pipeline.textures[0] = lit_color_texture_program_pipeline.textures[0];
+
+	return ret;
+});
+
+LitColorTextureProgram::LitColorTextureProgram(Variant variant) {
+	//The two variants differ only in where the object's matrices come from:
+	std::string vertex_shader;
+	if (variant == Plain) {
+		vertex_shader =
+			"#version 330\n"
+			+ CameraBlock::GLSL +
+			"uniform mat4x3 OBJECT_TO_LIGHT;\n"
+			"uniform mat3 NORMAL_TO_LIGHT;\n"
+			"in vec4 Position;\n"
+			"in vec3 Normal;\n"
+			"in vec4 Color;\n"
+			"in vec2 TexCoord;\n"
+			"out vec3 position;\n"
+			"out vec3 normal;\n"
+			"out vec4 color;\n"
+			"out vec2 texCoord;\n"
+			"void main() {\n"
+			"	position = OBJECT_TO_LIGHT * Position;\n"
+			"	gl_Position = LIGHT_TO_CLIP * vec4(position, 1.0);\n"
+			"	normal = NORMAL_TO_LIGHT * Normal;\n"
+			"	color = Color;\n"
+			"	texCoord = TexCoord;\n"
+			"}\n"
+		;
+	} else {
+		assert(variant == Instanced);
+		vertex_shader =
+			"#version 330\n"
+			+ CameraBlock::GLSL +
+			"in mat4x3 OBJECT_TO_WORLD;\n" //per-instance
+			"in vec4 Position;\n"
+			"in vec3 Normal;\n"
+			"in vec4 Color;\n"
+			"in vec2 TexCoord;\n"
+			"out vec3 position;\n"
+			"out vec3 normal;\n"
+			"out vec4 color;\n"
+			"out vec2 texCoord;\n"
+			"void main() {\n"
+			"	vec4 world_position = vec4(OBJECT_TO_WORLD * Position, 1.0);\n"
+			"	gl_Position = WORLD_TO_CLIP * world_position;\n"
+			"	position = vec3(WORLD_TO_LIGHT * world_position);\n"
+			"	mat3 object_to_light = mat3(WORLD_TO_LIGHT) * mat3(OBJECT_TO_WORLD);\n"
+			"	normal = inverse(transpose(object_to_light)) * Normal;\n"
+			"	color = Color;\n"
+			"	texCoord = TexCoord;\n"
+			"}\n"
+		;
+	}
+
 	//Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
 	program = gl_compile_program(
 		//vertex shader:
-		"#version 330\n"
-		"uniform mat4 OBJECT_TO_CLIP;\n"
-		"uniform mat4x3 OBJECT_TO_LIGHT;\n"
-		"uniform mat3 NORMAL_TO_LIGHT;\n"
-		"in vec4 Position;\n"
-		"in vec3 Normal;\n"
-		"in vec4 Color;\n"
-		"in vec2 TexCoord;\n"
-		"out vec3 position;\n"
-		"out vec3 normal;\n"
-		"out vec4 color;\n"
-		"out vec2 texCoord;\n"
-		"void main() {\n"
-		"	gl_Position = OBJECT_TO_CLIP * Position;\n"
-		"	position = OBJECT_TO_LIGHT * Position;\n"
-		"	normal = NORMAL_TO_LIGHT * Normal;\n"
-		"	color = Color;\n"
-		"	texCoord = TexCoord;\n"
-		"}\n"
+		vertex_shader
 	,
 		//fragment shader:
 		"#version 330\n"
+		+ LightsBlock::GLSL +
 		"uniform sampler2D TEX;\n"
-		"uniform int LIGHT_TYPE;\n"
-		"uniform vec3 LIGHT_LOCATION;\n"
-		"uniform vec3 LIGHT_DIRECTION;\n"
-		"uniform vec3 LIGHT_ENERGY;\n"
-		"uniform float LIGHT_CUTOFF;\n"
 		"in vec3 position;\n"
 		"in vec3 normal;\n"
 		"in vec4 color;\n"
 		"in vec2 texCoord;\n"
 		"out vec4 fragColor;\n"
-		"void main() {\n"
-		"	vec3 n = normalize(normal);\n"
-		"	vec3 e;\n"
-		"	if (LIGHT_TYPE == 0) { //point light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
+		"vec3 light_energy(Light light, vec3 n) {\n"
+		"	int type = int(light.LOCATION.w);\n"
+		"	if (type == 0) { //point light \n"
+		"		vec3 l = (light.LOCATION.xyz - position);\n"
 		"		float dis2 = dot(l,l);\n"
 		"		l = normalize(l);\n"
 		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 1) { //hemi light \n"
-		"		e = (dot(n,-LIGHT_DIRECTION) * 0.5 + 0.5) * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 2) { //spot light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
+		"		return nl * light.ENERGY.rgb;\n"
+		"	} else if (type == 1) { //hemi light \n"
+		"		return (dot(n,-light.DIRECTION.xyz) * 0.5 + 0.5) * light.ENERGY.rgb;\n"
+		"	} else if (type == 2) { //spot light \n"
+		"		vec3 l = (light.LOCATION.xyz - position);\n"
 		"		float dis2 = dot(l,l);\n"
 		"		l = normalize(l);\n"
 		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		float c = dot(l,-LIGHT_DIRECTION);\n"
-		"		nl *= smoothstep(LIGHT_CUTOFF,mix(LIGHT_CUTOFF,1.0,0.1), c);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else { //(LIGHT_TYPE == 3) //directional light \n"
-		"		e = max(0.0, dot(n,-LIGHT_DIRECTION)) * LIGHT_ENERGY;\n"
+		"		float c = dot(l,-light.DIRECTION.xyz);\n"
+		"		float cutoff = light.DIRECTION.w;\n"
+		"		nl *= smoothstep(cutoff,mix(cutoff,1.0,0.1), c);\n"
+		"		return nl * light.ENERGY.rgb;\n"
+		"	} else { //(type == 3) //directional light \n"
+		"		return max(0.0, dot(n,-light.DIRECTION.xyz)) * light.ENERGY.rgb;\n"
+		"	}\n"
+		"}\n"
+		"void main() {\n"
+		"	vec3 n = normalize(normal);\n"
+		"	vec3 e = vec3(0.0);\n"
+		"	for (uint i = 0u; i < LIGHT_INDEX_COUNT; ++i) {\n"
+		"		e += light_energy(LIGHTS[LIGHT_INDICES[i]], n);\n"
 		"	}\n"
 		"	vec4 albedo = texture(TEX, texCoord) * color;\n"
 		"	fragColor = vec4(e*albedo.rgb, albedo.a);\n"
@@ -114,18 +163,16 @@ LitColorTextureProgram::LitColorTextureProgram() {
 	Normal_vec3 = glGetAttribLocation(program, "Normal");
 	Color_vec4 = glGetAttribLocation(program, "Color");
 	TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
+	OBJECT_TO_WORLD_mat4x3 = glGetAttribLocation(program, "OBJECT_TO_WORLD");
 
 	//look up the locations of uniforms:
-	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
 	OBJECT_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "OBJECT_TO_LIGHT");
 	NORMAL_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_TO_LIGHT");
+	LIGHT_INDEX_COUNT_uint = glGetUniformLocation(program, "LIGHT_INDEX_COUNT");
+	LIGHT_INDICES_uint_array = glGetUniformLocation(program, "LIGHT_INDICES");
 
-	LIGHT_TYPE_int = glGetUniformLocation(program, "LIGHT_TYPE");
-	LIGHT_LOCATION_vec3 = glGetUniformLocation(program, "LIGHT_LOCATION");
-	LIGHT_DIRECTION_vec3 = glGetUniformLocation(program, "LIGHT_DIRECTION");
-	LIGHT_ENERGY_vec3 = glGetUniformLocation(program, "LIGHT_ENERGY");
-	LIGHT_CUTOFF_float = glGetUniformLocation(program, "LIGHT_CUTOFF");
-
+	//connect the Camera and Lights blocks to their uniform buffers:
+	bind_uniform_blocks(program);
 
 	GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
 
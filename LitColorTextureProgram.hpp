@@ -6,7 +6,12 @@
 
 //Shader program that draws transformed, lit, textured vertices tinted with vertex colors:
 struct LitColorTextureProgram {
-	LitColorTextureProgram();
+	//the Instanced variant takes object matrices from a per-instance attribute (for Scene::Instanced) instead of uniforms:
+	enum Variant {
+		Plain,
+		Instanced
+	};
+	LitColorTextureProgram(Variant variant = Plain);
 	~LitColorTextureProgram();
 
 	GLuint program = 0;
@@ -16,19 +21,18 @@ struct LitColorTextureProgram {
 	GLuint Normal_vec3 = -1U;
 	GLuint Color_vec4 = -1U;
 	GLuint TexCoord_vec2 = -1U;
+	GLuint OBJECT_TO_WORLD_mat4x3 = -1U; //(Instanced only; per-instance)
 
 	//Uniform (per-invocation variable) locations:
-	GLuint OBJECT_TO_CLIP_mat4 = -1U;
-	GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
-	GLuint NORMAL_TO_LIGHT_mat3 = -1U;
-
-	//lighting:
-	GLuint LIGHT_TYPE_int = -1U;
-	GLuint LIGHT_LOCATION_vec3 = -1U;
-	GLuint LIGHT_DIRECTION_vec3 = -1U;
-	GLuint LIGHT_ENERGY_vec3 = -1U;
-	GLuint LIGHT_CUTOFF_float = -1U;
-	
+	GLuint OBJECT_TO_LIGHT_mat4x3 = -1U; //(Plain only)
+	GLuint NORMAL_TO_LIGHT_mat3 = -1U; //(Plain only)
+	GLuint LIGHT_INDEX_COUNT_uint = -1U;
+	GLuint LIGHT_INDICES_uint_array = -1U;
+
+	//Uniform blocks (see UniformBlocks.hpp):
+	//Camera - clip and light space (the Plain variant uses LIGHT_TO_CLIP, so needs no per-object OBJECT_TO_CLIP)
+	//Lights - lights (the sum of the LIGHT_INDEX_COUNT LIGHTS listed in LIGHT_INDICES is used)
+
 	//Textures:
 	//TEXTURE0 - texture that is accessed by TexCoord
 };
@@ -38,3 +42,8 @@ extern Load< LitColorTextureProgram > lit_color_texture_program;
 //For convenient scene-graph setup, copy this object:
 // NOTE: by default, has texture bound to 1-pixel white texture -- so it's okay to use with vertex-color-only meshes.
 extern Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
+
+//Instanced variant, and its pipeline template (for Scene::Instanced):
+// NOTE: build vaos for it with MeshBuffer::make_vao_for_program(program, {"OBJECT_TO_WORLD"}), since Scene::draw binds that attribute
+extern Load< LitColorTextureProgram > lit_color_texture_instanced_program;
+extern Scene::Instanced::Pipeline lit_color_texture_instanced_program_pipeline;
@@ -9,6 +9,7 @@
 #include <vector>
 #include <string>
 #include <set>
+#include <algorithm>
 #include <cstddef>
 
 MeshBuffer::MeshBuffer(std::string const &filename) {
@@ -106,7 +107,7 @@ const Mesh &MeshBuffer::lookup(std::string const &name) const {
 	return f->second;
 }
 
-GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
+GLuint MeshBuffer::make_vao_for_program(GLuint program, std::vector< std::string > const &unbound) const {
 	//create a new vertex array object:
 	GLuint vao = 0;
 	glGenVertexArrays(1, &vao);
@@ -141,6 +142,7 @@ GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
 		glGetActiveAttrib(program, i, 100, NULL, &size, &type, name);
 		name[99] = '\0';
 		GLint location = glGetAttribLocation(program, name);
+		if (std::find(unbound.begin(), unbound.end(), std::string(name)) != unbound.end()) continue;
 		if (!bound.count(GLuint(location))) {
 			throw std::runtime_error("ERROR: active attribute '" + std::string(name) + "' in program is not bound.");
 		}
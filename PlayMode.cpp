@@ -13,15 +13,9 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/quaternion.hpp>
 
+#include <algorithm>
 #include <random>
 
-//Floating point equality from 
-//http://www.cs.technion.ac.il/users/yechiel/c++-faq/floating-point-arith.html
-inline bool isEqual(float x, float y) { 
-  const float epsilon = 0.1f;
-  return std::abs(x - y) <= epsilon * std::abs(x);
-}
-
 Load< Sound::Sample > big_robot_hit(LoadTagDefault, []() -> Sound::Sample const * {
 	return new Sound::Sample(data_path("big_robot_hit.wav"));
 });
@@ -39,9 +33,11 @@ Load< Sound::Sample > pew(LoadTagDefault, []() -> Sound::Sample const * {
 });
 
 GLuint phonebank_meshes_for_lit_color_texture_program = 0;
+GLuint phonebank_meshes_for_lit_color_texture_instanced_program = 0;
 Load< MeshBuffer > phonebank_meshes(LoadTagDefault, []() -> MeshBuffer const * {
 	MeshBuffer const *ret = new MeshBuffer(data_path("place.pnct"));
 	phonebank_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
+	phonebank_meshes_for_lit_color_texture_instanced_program = ret->make_vao_for_program(lit_color_texture_instanced_program->program, {"OBJECT_TO_WORLD"});
 	return ret;
 });
 
@@ -59,6 +55,8 @@ Load< Scene > phonebank_scene(LoadTagDefault, []() -> Scene const * {
 		drawable.pipeline.start = mesh.start;
 		drawable.pipeline.count = mesh.count;
 
+		drawable.min = mesh.min;
+		drawable.max = mesh.max;
 	});
 });
 
@@ -69,9 +67,9 @@ Load< WalkMeshes > phonebank_walkmeshes(LoadTagDefault, []() -> WalkMeshes const
 	return ret;
 });
 
-PlayMode::PlayMode() : scene(*phonebank_scene) {
+PlayMode::PlayMode() : cargo_field(*walkmesh), enemy_crowd(*walkmesh, 1.0f), scene(*phonebank_scene) {
 	//create a player transform:
-	for (auto drawable : scene.drawables) {
+	for (auto &drawable : scene.drawables) {
 		if (drawable.transform->name == "Torus") {
 			enemy = &drawable;
 			eTrans = drawable.transform;
@@ -89,7 +87,35 @@ PlayMode::PlayMode() : scene(*phonebank_scene) {
 		}
 	}
 
+	//bullets and enemies are drawn as instances of the bullet and enemy meshes:
+	auto make_instanced = [this](Scene::Drawable const &like) {
+		Scene::Instanced &instanced = scene.instanced.emplace_back();
+		instanced.pipeline = lit_color_texture_instanced_program_pipeline;
+		instanced.pipeline.vao = phonebank_meshes_for_lit_color_texture_instanced_program;
+		instanced.pipeline.type = like.pipeline.type;
+		instanced.pipeline.start = like.pipeline.start;
+		instanced.pipeline.count = like.pipeline.count;
+		instanced.min = like.min;
+		instanced.max = like.max;
+		return &instanced;
+	};
+	assert(bullet && enemy);
+	bullet_instances = make_instanced(*bullet);
+	enemy_instances = make_instanced(*enemy);
+
+	//build a flow field over the walkmesh toward the nearest piece of cargo:
+	for (auto c : cargo) {
+		cargo_sources.emplace_back(cargo_field.add_source(walkmesh->nearest_walk_point(c->position)));
+	}
+
 	glGenBuffers(1, &vertex_buffer);
+
+	//light everything from above with a hemisphere light, in addition to any lights in the scene file:
+	scene.transforms.emplace_back(); //(default orientation, so shining along -z, i.e., down)
+	scene.lights.emplace_back(&scene.transforms.back());
+	scene.lights.back().type = Scene::Light::Hemisphere;
+	scene.lights.back().energy = glm::vec3(1.0f, 1.0f, 0.95f);
+
 	scene.transforms.emplace_back();
 	player.transform = &scene.transforms.back();
 
@@ -201,7 +227,7 @@ void PlayMode::update(float elapsed) {
 
 		move_bullets(elapsed);
 		generate_bot(elapsed);
-		move_enemies();
+		move_enemies(elapsed);
 		enemy_die();
 		cargo_taken();
 		robot_damage(elapsed);
@@ -238,23 +264,8 @@ void PlayMode::update(float elapsed) {
 				//rotate step to follow surface:
 				remain = rotation * remain;
 			} else {
-				//ran into a wall, bounce / slide along it:
-				glm::vec3 const &a = walkmesh->vertices[player.at.indices.x];
-				glm::vec3 const &b = walkmesh->vertices[player.at.indices.y];
-				glm::vec3 const &c = walkmesh->vertices[player.at.indices.z];
-				glm::vec3 along = glm::normalize(b-a);
-				glm::vec3 normal = glm::normalize(glm::cross(b-a, c-a));
-				glm::vec3 in = glm::cross(normal, along);
-
-				//check how much 'remain' is pointing out of the triangle:
-				float d = glm::dot(remain, in);
-				if (d < 0.0f) {
-					//bounce off of the wall:
-					remain += (-1.25f * d) * in;
-				} else {
-					//if it's just pointing along the edge, bend slightly away from wall:
-					remain += 0.01f * d * in;
-				}
+				//ran into a wall (or a disabled edge), bounce / slide along it:
+				remain = walkmesh->slide_along_wall(player.at, remain);
 			}
 			//printf("done cross edge, %f %f %f\n", end.weights.x, end.weights.y, end.weights.z);
 		}
@@ -284,6 +295,9 @@ void PlayMode::update(float elapsed) {
 	}
 		//printf("%f %f %f\n", player.transform->position.x, player.transform->position.y, player.transform->position.z);
 
+	//everything has moved for this frame, so bring world matrices up to date for drawing:
+	scene.update_transforms();
+
 	//reset button press counters:
 	left.downs = 0;
 	right.downs = 0;
@@ -293,23 +307,19 @@ void PlayMode::update(float elapsed) {
 
 void PlayMode::shoot() {
 	bullet->transform = bTrans;
-	Scene::Drawable *new_bullet = new Scene::Drawable();
-	new_bullet->pipeline = bPipe;
 
-	Scene::Transform *t = new Scene::Transform;
+	Scene::Transform *t = &scene.transforms.emplace_back();
 	t->rotation = player.transform->rotation;
 	t->position = player.transform->position;
 	t->scale = bullet->transform->scale;
 	t->name = "bullet";
 	//t->parent = player.transform;
-	scene.transforms.emplace_back(*t);
 
-	new_bullet->transform = t;
+	bullet_instances->transforms.emplace_back(t);
 	bullet_info *bi = new bullet_info;
 	bi->t = t;
 	//bi->dir = normalize(glm::vec3(inv[2]));;
 	//printf("dir %f %f %f\n", bi->dir.x, bi->dir.y, bi->dir.z);
-	scene.drawables.emplace_back(*new_bullet);
 	bullets.push_back(bi);
 	// auto yaw = glm::yaw(t->rotation) * (180.0f / 3.14159265f) * 60.0f;
 	// auto roll = glm::roll(t->rotation) * (180.0f / 3.14159265f);
@@ -318,6 +328,26 @@ void PlayMode::shoot() {
 	Sound::play(*pew, 1.0f, 0.0f);
 }
 
+void PlayMode::remove_instance(Scene::Instanced *instances_, Scene::Transform *transform) {
+	assert(instances_);
+	auto &instances = *instances_;
+	auto f = std::find(instances.transforms.begin(), instances.transforms.end(), transform);
+	assert(f != instances.transforms.end() && "transform should be drawn by these instances");
+	//(instance order doesn't matter, so swap with the last one rather than shifting):
+	*f = instances.transforms.back();
+	instances.transforms.pop_back();
+	scene.transforms.erase(transform);
+}
+
+void PlayMode::remove_enemy(size_t i) {
+	assert(i < enemies.size() && enemy_agents.size() == enemies.size());
+	remove_instance(enemy_instances, enemies[i]->t);
+	//(enemy order doesn't matter, so swap with the last one, as WalkAgents::remove does):
+	enemies[i] = enemies.back();
+	enemies.pop_back();
+	enemy_agents.remove(uint32_t(i));
+}
+
 void PlayMode::move_bullets(float elapsed) {
 	for (size_t i = 0; i < bullets.size(); i++) {
 		bullets[i]->age += elapsed;
@@ -329,8 +359,7 @@ void PlayMode::move_bullets(float elapsed) {
 		bullets[i]->t->position += up * move.z - (forward/2.0f) * move.y;
 	}
 	if (bullets.size() > 0 && bullets.front()->age > 3.0f) {
-		bullets.front()->t->scale = glm::vec3(0.0f,0.0f,0.0f);
-		bullets.front()->t->position = glm::vec3(0.0f, 0.0f, -100.0f);
+		remove_instance(bullet_instances, bullets.front()->t);
 		bullets.pop_front();
 	}
 }
@@ -339,53 +368,54 @@ void PlayMode::generate_bot(float elapsed) {
 	bot_gen += elapsed;
 	if (bot_gen > bot_time && enemies.size() < 10) {
 		enemy->transform = eTrans;
-		Scene::Drawable *new_enemy = new Scene::Drawable();
-		new_enemy->pipeline = ePipe;
 
-		Scene::Transform *t = new Scene::Transform;
+		Scene::Transform *t = &scene.transforms.emplace_back();
 		t->rotation = enemy->transform->rotation;
 		t->position = enemy->transform->position;
 		t->scale = enemy->transform->scale;
 		t->name = "enemy";
 		//t->parent = player.transform;
-		scene.transforms.emplace_back(*t);
 
-		new_enemy->transform = t;
+		enemy_instances->transforms.emplace_back(t);
 		//printf("%f %f %f\n", player.transform->position.x, player.transform->position.y, player.transform->position.z);
 		//printf("%f %f %f\n", new_bullet->transform->position.x, new_bullet->transform->position.y, new_bullet->transform->position.z);
 
 		enemy_info *ei = new enemy_info;
 		ei->t = t;
-		int target = rand() % cargo.size();
-		ei->dir = cargo[target]->position;
+		//start on the walkmesh surface under the spawn point (or the nearest point, if there is nothing under it):
+		WalkPoint at;
+		float height;
+		if (!walkmesh->height_at(glm::vec2(t->position), t->position.z, &at, &height)) {
+			at = walkmesh->nearest_walk_point(t->position);
+		}
 
-		scene.drawables.emplace_back(*new_enemy);
 		enemies.push_back(ei);
+		enemy_agents.add(walkmesh->to_triangle_walk_point(at));
+		assert(enemy_agents.size() == enemies.size());
 		bot_time = bot_gen + 4.0f;
 	}
 }
 
-void PlayMode::move_enemies() {
+void PlayMode::move_enemies(float elapsed) {
+	constexpr float EnemySpeed = 3.0f;
+	constexpr float EnemyHover = 1.0f; //height of enemy above the walkmesh
+
+	//enemies walk the walkmesh, following the flow field toward the nearest cargo:
+	assert(enemy_agents.size() == enemies.size());
 	for (size_t i = 0; i < enemies.size(); i++) {
-		auto target = enemies[i]->dir;
-		if (enemies[i]->t->position.x < target.x) {
-			enemies[i]->t->position.x += 0.05f;
-		} else if (enemies[i]->t->position.x > target.x) {
-			enemies[i]->t->position.x -= 0.05f;
-		}
+		TriangleWalkPoint at = enemy_agents.get(uint32_t(i));
+		//(don't step past the cargo)
+		float step = std::min(EnemySpeed * elapsed, cargo_field.distance_at(at));
+		enemy_agents.set_step(uint32_t(i), cargo_field.direction(at) * step);
+	}
 
-		if (enemies[i]->t->position.y < target.y) {
-			enemies[i]->t->position.y += 0.05f;
-		} else if (enemies[i]->t->position.y > target.y) {
-			enemies[i]->t->position.y -= 0.05f;
-		}
+	//(push enemies apart so they don't all walk the same line)
+	enemy_crowd.step(enemy_agents);
 
-		if (isEqual(enemies[i]->t->position.y, target.y) &&
-			isEqual(enemies[i]->t->position.x, target.x)) {
-			if (enemies[i]->t->position.z > target.z) {
-				enemies[i]->t->position.z -= 0.05f;
-			}
-		}
+	for (size_t i = 0; i < enemies.size(); i++) {
+		TriangleWalkPoint at = enemy_agents.get(uint32_t(i));
+		enemies[i]->t->position = walkmesh->to_world_point(at)
+			+ EnemyHover * walkmesh->to_world_smooth_normal(at);
 	}
 }
 
@@ -396,20 +426,17 @@ void PlayMode::cargo_taken() {
 			std::max(enemies[j]->t->position[1] - 0.8f, cargo[i]->position[1] - 0.8f) <= std::min(enemies[j]->t->position[1] + 0.8f, cargo[i]->position[1] + 0.8f) && 
 			std::max(enemies[j]->t->position[2] - 0.8f, cargo[i]->position[2] - 0.8f) <= std::min(enemies[j]->t->position[2] + 0.8f, cargo[i]->position[2] + 0.8f)) {
 				cargo[i]->position = glm::vec3(0.0f, 0.0f, -100.0f);
-				enemies[j]->t->position = glm::vec3(0.0f, 0.0f, -100.0f);
 				cargo[i]->scale = glm::vec3(0.0f, 0.0f, 0.0f);
-				enemies[j]->t->scale = glm::vec3(0.0f, 0.0f, 0.0f);
-				enemies.erase(enemies.begin() + j);
+				remove_enemy(j);
 				cargo.erase(cargo.begin() + i);
+				//(enemies that were headed for this cargo now flow toward the next-nearest one)
+				cargo_field.remove_source(cargo_sources[i]);
+				cargo_sources.erase(cargo_sources.begin() + i);
 				Sound::play(*cargo_lost, 1.0f, 0.0f);
 				if (cargo.size() <= 0) {
 					lose = true;
 					return;
 				}
-				for (size_t j = 0; j < enemies.size(); j++) {
-					int target = rand() % cargo.size();
-					enemies[j]->dir = cargo[target]->position;
-				}
 				return;
 			}
 		}
@@ -423,8 +450,7 @@ void PlayMode::robot_damage(float elapsed) {
 			std::max(bullets[j]->t->position[1] - 0.1f, robot->position[1] - 10.0f) <= std::min(bullets[j]->t->position[1] + 0.1f, robot->position[1] + 10.0f) && 
 			std::max(bullets[j]->t->position[2] - 0.1f, robot->position[2] - 8.0f) <= std::min(bullets[j]->t->position[2] + 0.1f, robot->position[2] + 8.0f)) {
 			
-			bullets[j]->t->position = glm::vec3(0.0f, 0.0f, -100.0f);
-			bullets[j]->t->scale = glm::vec3(0.0f, 0.0f, 0.0f);
+			remove_instance(bullet_instances, bullets[j]->t);
 			bullets.erase(bullets.begin() + j);
 			
 			if (hit_invinc > hit_time) {
@@ -447,12 +473,9 @@ void PlayMode::enemy_die() {
 			if (std::max(bullets[j]->t->position[0] - 0.1f, enemies[i]->t->position[0] - 0.8f) <= std::min(bullets[j]->t->position[0] + 0.1f, enemies[i]->t->position[0] + 0.8f) &&
 			std::max(bullets[j]->t->position[1] - 0.1f, enemies[i]->t->position[1] - 0.8f) <= std::min(bullets[j]->t->position[1] + 0.1f, enemies[i]->t->position[1] + 0.8f) && 
 			std::max(bullets[j]->t->position[2] - 0.1f, enemies[i]->t->position[2] - 0.8f) <= std::min(bullets[j]->t->position[2] + 0.1f, enemies[i]->t->position[2] + 0.8f)) {
-				enemies[i]->t->position = glm::vec3(0.0f, 0.0f, -100.0f);
-				bullets[j]->t->position = glm::vec3(0.0f, 0.0f, -100.0f);
-				enemies[i]->t->scale = glm::vec3(0.0f, 0.0f, 0.0f);
-				bullets[j]->t->scale = glm::vec3(0.0f, 0.0f, 0.0f);
+				remove_enemy(i);
+				remove_instance(bullet_instances, bullets[j]->t);
 				bullets.erase(bullets.begin() + j);
-				enemies.erase(enemies.begin() + i);
 				Sound::play(*enemy_hit, 1.0f, 0.0f);
 				return;
 			}
@@ -465,14 +488,7 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 	
 	player.camera->aspect = float(drawable_size.x) / float(drawable_size.y);
 
-	//set up light type and position for lit_color_texture_program:
-	// TODO: consider using the Light(s) in the scene to do this
-	glUseProgram(lit_color_texture_program->program);
-	glUniform1i(lit_color_texture_program->LIGHT_TYPE_int, 1);
-	glUniform3fv(lit_color_texture_program->LIGHT_DIRECTION_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 0.0f,-1.0f)));
-	glUniform3fv(lit_color_texture_program->LIGHT_ENERGY_vec3, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.95f)));
-
-	glUseProgram(0);
+	//(camera and lights uniform blocks are uploaded by scene.draw, from scene.lights)
 
 	glClearColor(0.5f, 0.2f, 0.5f, 1.0f);
 	glClearDepth(1.0f); //1.0 is actually the default value to clear the depth buffer to, but FYI you can change it.
@@ -481,7 +497,7 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_LESS); //this is the default depth comparison function, but FYI you can change it.
 
-	scene.draw(*player.camera);
+	draw_counts = scene.draw(*player.camera);
 
 	{ //use DrawLines to overlay some text:
 		glDisable(GL_DEPTH_TEST);
@@ -515,6 +531,13 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 				glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f),
 				glm::u8vec4(0xff, 0xff, 0xff, 0x00));
 		}
+
+		//report how much of the scene was drawn (the rest was culled):
+		constexpr float SmallH = 0.04f;
+		lines.draw_text("drawn " + std::to_string(draw_counts.drawn) + " culled " + std::to_string(draw_counts.culled),
+			glm::vec3(-aspect + 0.5f * SmallH, -1.0f + 0.5f * SmallH, 0.0),
+			glm::vec3(SmallH, 0.0f, 0.0f), glm::vec3(0.0f, SmallH, 0.0f),
+			glm::u8vec4(0xff, 0xff, 0xff, 0x00));
 	}
 
 	GL_ERRORS();
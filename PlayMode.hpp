@@ -2,6 +2,8 @@
 
 #include "Scene.hpp"
 #include "WalkMesh.hpp"
+#include "WalkFlowField.hpp"
+#include "WalkCrowd.hpp"
 
 #include <glm/glm.hpp>
 
@@ -17,7 +19,7 @@ struct bullet_info {
 
 struct enemy_info {
 	Scene::Transform *t;
-	glm::vec3 dir;
+	//(location on walkmesh is in PlayMode::enemy_agents, at the same index as in PlayMode::enemies)
 };
 
 struct PlayMode : Mode {
@@ -31,10 +33,14 @@ struct PlayMode : Mode {
 	virtual void shoot();
 	virtual void move_bullets(float elapsed);
 	virtual void generate_bot(float elapsed);
-	virtual void move_enemies();
+	virtual void move_enemies(float elapsed);
 	virtual void enemy_die();
 	virtual void cargo_taken();
 	virtual void robot_damage(float elapsed);
+	//stop drawing one of the transforms in instances, and free it from the scene:
+	virtual void remove_instance(Scene::Instanced *instances, Scene::Transform *transform);
+	//remove enemies[i] (and its agent and instance) by moving the last enemy into its slot:
+	virtual void remove_enemy(size_t i);
 
 	//----- game state -----
 
@@ -52,9 +58,15 @@ struct PlayMode : Mode {
 	Scene::Transform *robot = nullptr;
 	Scene::Transform *eTrans = nullptr;
 	Scene::Drawable::Pipeline ePipe;
+	Scene::Instanced *bullet_instances = nullptr; //every bullet is an instance of bullet's mesh
+	Scene::Instanced *enemy_instances = nullptr; //...and every enemy an instance of enemy's mesh
 	std::deque<bullet_info *> bullets;
 	std::vector<enemy_info *> enemies;
 	std::vector<Scene::Transform *> cargo;
+	WalkFlowField cargo_field; //enemies follow this to walk toward the nearest cargo (one source per cargo)
+	std::vector<uint32_t> cargo_sources; //cargo_field source id of each cargo
+	WalkAgents enemy_agents; //where each enemy is on the walkmesh (agent i is enemies[i]; kept between ticks so walking doesn't reallocate)
+	WalkCrowd enemy_crowd; //keeps enemies from bunching up on the way
 
 	float bot_time = 0.0f;
 	float bot_gen = 0.0f;
@@ -69,6 +81,7 @@ struct PlayMode : Mode {
 
 	//local copy of the game scene (so code can change it during gameplay):
 	Scene scene;
+	Scene::DrawCounts draw_counts; //from the most recent scene.draw (shown in the corner of the screen)
 
 	//player info:
 	struct Player {
@@ -0,0 +1,209 @@
+#pragma once
+
+/*
+ * A Pool holds objects in fixed-size chunks of slots, so (like std::list)
+ *  pointers to its elements stay valid as other elements come and go, but
+ *  (unlike std::list) elements sit next to each other in memory.
+ *
+ * Erased slots go on a free list and are reused by later emplace_back calls,
+ *  so iteration is in slot order, which is not always insertion order.
+ *
+ * Copying a pool keeps every element in the same slot, so index_of / at_index
+ *  can translate pointers into one pool to pointers into a copy of it.
+ *
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+template< typename T, uint32_t ChunkSize = 256 >
+struct Pool {
+	Pool() = default;
+	Pool(Pool const &other) { *this = other; }
+	Pool &operator=(Pool const &other);
+	~Pool() { clear(); }
+
+	//construct an element in a free slot (or a new one) and return it:
+	template< typename... Args >
+	T &emplace_back(Args&&... args);
+
+	//most recently emplaced element (as with std::list, call right after emplace_back):
+	T &back() { assert(last); return *last; }
+	T const &back() const { assert(last); return *last; }
+
+	//destroy an element, freeing its slot for reuse:
+	void erase(T *element);
+
+	//destroy all elements and free all chunks:
+	void clear();
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	//incremented whenever elements are added or removed (so callers can tell when to rebuild data derived from the pool):
+	uint32_t revision = 0;
+
+	//iterate over elements in slot order:
+	template< typename P, typename E >
+	struct Iterator {
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = E *;
+		using reference = E &;
+
+		P *pool = nullptr;
+		uint32_t slot = 0;
+
+		E &operator*() const { return *pool->at_index(slot); }
+		E *operator->() const { return pool->at_index(slot); }
+		Iterator &operator++() {
+			do { ++slot; } while (slot < pool->slots && !pool->is_live(slot));
+			return *this;
+		}
+		Iterator operator++(int) { Iterator ret = *this; ++*this; return ret; }
+		bool operator==(Iterator const &o) const { return slot == o.slot; }
+		bool operator!=(Iterator const &o) const { return slot != o.slot; }
+	};
+	using iterator = Iterator< Pool, T >;
+	using const_iterator = Iterator< Pool const, T const >;
+
+	iterator begin() { return iterator{this, first_live()}; }
+	iterator end() { return iterator{this, slots}; }
+	const_iterator begin() const { return const_iterator{this, first_live()}; }
+	const_iterator end() const { return const_iterator{this, slots}; }
+
+	//--- internals ---
+	struct Chunk {
+		alignas(T) unsigned char storage[ChunkSize * sizeof(T)];
+		bool live[ChunkSize] = {};
+	};
+	std::vector< std::unique_ptr< Chunk > > chunks;
+	//chunks sorted by address, for finding the slot of an element:
+	std::vector< std::pair< Chunk const *, uint32_t > > chunk_order;
+
+	uint32_t slots = 0; //slots [0,slots) have been handed out (and are either live or on free_slots)
+	std::vector< uint32_t > free_slots;
+	size_t count = 0; //live elements
+	T *last = nullptr;
+
+	bool is_live(uint32_t slot) const { return chunks[slot / ChunkSize]->live[slot % ChunkSize]; }
+	T *at_index(uint32_t slot) {
+		return reinterpret_cast< T * >(chunks[slot / ChunkSize]->storage + (slot % ChunkSize) * sizeof(T));
+	}
+	T const *at_index(uint32_t slot) const {
+		return reinterpret_cast< T const * >(chunks[slot / ChunkSize]->storage + (slot % ChunkSize) * sizeof(T));
+	}
+	//slot of an element (which must be live in this pool):
+	uint32_t index_of(T const *element) const;
+	//slot of an element, or -1U if it is not a live element of this pool:
+	uint32_t find(T const *element) const;
+
+	uint32_t first_live() const {
+		uint32_t slot = 0;
+		while (slot < slots && !is_live(slot)) ++slot;
+		return slot;
+	}
+	void add_chunk();
+};
+
+template< typename T, uint32_t ChunkSize >
+void Pool< T, ChunkSize >::add_chunk() {
+	chunks.emplace_back(new Chunk);
+	std::pair< Chunk const *, uint32_t > entry(chunks.back().get(), uint32_t(chunks.size() - 1));
+	chunk_order.insert(std::upper_bound(chunk_order.begin(), chunk_order.end(), entry), entry);
+}
+
+template< typename T, uint32_t ChunkSize >
+template< typename... Args >
+T &Pool< T, ChunkSize >::emplace_back(Args&&... args) {
+	uint32_t slot;
+	if (!free_slots.empty()) {
+		slot = free_slots.back();
+	} else {
+		slot = slots;
+		if (slot / ChunkSize >= chunks.size()) add_chunk();
+	}
+	T *element = new (at_index(slot)) T(std::forward< Args >(args)...);
+	//(only update bookkeeping once construction has succeeded)
+	if (!free_slots.empty()) free_slots.pop_back();
+	else slots += 1;
+	chunks[slot / ChunkSize]->live[slot % ChunkSize] = true;
+	count += 1;
+	revision += 1;
+	last = element;
+	return *element;
+}
+
+template< typename T, uint32_t ChunkSize >
+uint32_t Pool< T, ChunkSize >::find(T const *element) const {
+	//last chunk starting at or before element:
+	auto f = std::upper_bound(chunk_order.begin(), chunk_order.end(), element, [](T const *e, std::pair< Chunk const *, uint32_t > const &c) {
+		return std::less< void const * >()(e, c.first);
+	});
+	if (f == chunk_order.begin()) return -1U;
+	--f;
+	size_t offset = size_t(reinterpret_cast< uintptr_t >(element) - reinterpret_cast< uintptr_t >(f->first->storage));
+	if (offset >= ChunkSize * sizeof(T) || offset % sizeof(T) != 0) return -1U;
+	uint32_t slot = f->second * ChunkSize + uint32_t(offset / sizeof(T));
+	if (slot >= slots || !is_live(slot)) return -1U;
+	return slot;
+}
+
+template< typename T, uint32_t ChunkSize >
+uint32_t Pool< T, ChunkSize >::index_of(T const *element) const {
+	uint32_t slot = find(element);
+	assert(slot != -1U && "element should be in this pool");
+	return slot;
+}
+
+template< typename T, uint32_t ChunkSize >
+void Pool< T, ChunkSize >::erase(T *element) {
+	uint32_t slot = index_of(element);
+	element->~T();
+	chunks[slot / ChunkSize]->live[slot % ChunkSize] = false;
+	free_slots.emplace_back(slot);
+	count -= 1;
+	revision += 1;
+	if (last == element) last = nullptr;
+}
+
+template< typename T, uint32_t ChunkSize >
+void Pool< T, ChunkSize >::clear() {
+	for (uint32_t slot = 0; slot < slots; ++slot) {
+		if (is_live(slot)) at_index(slot)->~T();
+	}
+	chunks.clear();
+	chunk_order.clear();
+	slots = 0;
+	free_slots.clear();
+	count = 0;
+	revision += 1;
+	last = nullptr;
+}
+
+template< typename T, uint32_t ChunkSize >
+Pool< T, ChunkSize > &Pool< T, ChunkSize >::operator=(Pool const &other) {
+	if (&other == this) return *this;
+	clear();
+	while (chunks.size() < other.chunks.size()) add_chunk();
+	//copy elements into the same slots they occupy in other:
+	for (uint32_t slot = 0; slot < other.slots; ++slot) {
+		if (!other.is_live(slot)) continue;
+		new (at_index(slot)) T(*other.at_index(slot));
+		chunks[slot / ChunkSize]->live[slot % ChunkSize] = true;
+		slots = slot + 1; //(so clear() can clean up if a later copy throws)
+		count += 1;
+	}
+	slots = other.slots;
+	free_slots = other.free_slots;
+	if (other.last) last = at_index(other.index_of(other.last));
+	return *this;
+}
@@ -1,14 +1,80 @@
 #include "Scene.hpp"
 
+#include "UniformBlocks.hpp"
 #include "gl_errors.hpp"
 #include "read_write_chunk.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <fstream>
+#include <numeric>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#endif
 
 //-------------------------
 
+//compose two affine transformations, a * b (as if both were padded with a (0,0,0,1) row):
+// this is the inner loop of the hierarchy update, so it has an SSE version
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+
+static_assert(sizeof(glm::mat4x3) == 12 * sizeof(float), "mat4x3 is 12 packed floats.");
+
+static void compose(glm::mat4x3 const &a, glm::mat4x3 const &b, glm::mat4x3 *out_) {
+	assert(out_);
+	//columns are 3 floats, so load 12 floats as three 4-float registers and shuffle out the columns:
+	// (the fourth lane of each column is junk, and is never stored)
+	auto load_columns = [](glm::mat4x3 const &m, __m128 *c) {
+		float const *f = glm::value_ptr(m);
+		__m128 l0 = _mm_loadu_ps(f + 0); //x0 y0 z0 x1
+		__m128 l1 = _mm_loadu_ps(f + 4); //y1 z1 x2 y2
+		__m128 l2 = _mm_loadu_ps(f + 8); //z2 x3 y3 z3
+		c[0] = l0;
+		__m128 t = _mm_shuffle_ps(l0, l1, _MM_SHUFFLE(1,0,3,3)); //x1 x1 y1 z1
+		c[1] = _mm_shuffle_ps(t, t, _MM_SHUFFLE(3,3,2,0));
+		c[2] = _mm_shuffle_ps(l1, l2, _MM_SHUFFLE(0,0,3,2));
+		c[3] = _mm_shuffle_ps(l2, l2, _MM_SHUFFLE(3,3,2,1));
+	};
+	__m128 ac[4], bc[4];
+	load_columns(a, ac);
+	load_columns(b, bc);
+
+	__m128 r[4];
+	for (uint32_t i = 0; i < 4; ++i) {
+		r[i] = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(ac[0], _mm_shuffle_ps(bc[i], bc[i], _MM_SHUFFLE(0,0,0,0))),
+			_mm_mul_ps(ac[1], _mm_shuffle_ps(bc[i], bc[i], _MM_SHUFFLE(1,1,1,1)))),
+			_mm_mul_ps(ac[2], _mm_shuffle_ps(bc[i], bc[i], _MM_SHUFFLE(2,2,2,2))));
+	}
+	r[3] = _mm_add_ps(r[3], ac[3]);
+
+	//pack columns back into 12 floats:
+	float *f = glm::value_ptr(*out_);
+	__m128 t0 = _mm_shuffle_ps(r[0], r[1], _MM_SHUFFLE(0,0,2,2)); //z0 z0 x1 x1
+	_mm_storeu_ps(f + 0, _mm_shuffle_ps(r[0], t0, _MM_SHUFFLE(2,0,1,0))); //x0 y0 z0 x1
+	_mm_storeu_ps(f + 4, _mm_shuffle_ps(r[1], r[2], _MM_SHUFFLE(1,0,2,1))); //y1 z1 x2 y2
+	__m128 t2 = _mm_shuffle_ps(r[2], r[3], _MM_SHUFFLE(0,0,2,2)); //z2 z2 x3 x3
+	_mm_storeu_ps(f + 8, _mm_shuffle_ps(t2, r[3], _MM_SHUFFLE(2,1,2,0))); //z2 x3 y3 z3
+}
+
+#else //no SSE
+
+static void compose(glm::mat4x3 const &a, glm::mat4x3 const &b, glm::mat4x3 *out_) {
+	assert(out_);
+	auto &out = *out_;
+	for (uint32_t i = 0; i < 4; ++i) {
+		for (uint32_t r = 0; r < 3; ++r) {
+			out[i][r] = a[0][r] * b[i][0] + a[1][r] * b[i][1] + a[2][r] * b[i][2] + (i == 3 ? a[3][r] : 0.0f);
+		}
+	}
+}
+
+#endif
+
 glm::mat4x3 Scene::Transform::make_local_to_parent() const {
 	//compute:
 	//   translate   *   rotate    *   scale
@@ -57,17 +123,148 @@ glm::mat4x3 Scene::Transform::make_parent_to_local() const {
 }
 
 glm::mat4x3 Scene::Transform::make_local_to_world() const {
+	update_local_to_world();
+	return cache.local_to_world;
+}
+glm::mat4x3 Scene::Transform::make_world_to_local() const {
+	update_local_to_world();
+	update_world_to_local();
+	return cache.world_to_local;
+}
+
+void Scene::Transform::update_local_to_world() const {
+	if (parent) parent->update_local_to_world();
+	update_local_to_world_from_parent();
+}
+
+void Scene::Transform::update_local_to_world_from_parent() const {
+	uint32_t parent_version = (parent ? parent->cache.version : 0);
+	assert(!parent || parent_version != 0);
+
+	//nothing changed since last build?
+	if (cache.version != 0
+	 && cache.position == position
+	 && cache.rotation == rotation
+	 && cache.scale == scale
+	 && cache.parent == parent
+	 && cache.parent_version == parent_version) {
+		return;
+	}
+
 	if (!parent) {
-		return make_local_to_parent();
+		cache.local_to_world = make_local_to_parent();
 	} else {
-		return parent->make_local_to_world() * glm::mat4(make_local_to_parent()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		compose(parent->cache.local_to_world, make_local_to_parent(), &cache.local_to_world);
 	}
+	cache.position = position;
+	cache.rotation = rotation;
+	cache.scale = scale;
+	cache.parent = parent;
+	cache.parent_version = parent_version;
+	cache.version += 1;
+	if (cache.version == 0) cache.version = 1; //(skip 'never built' on wrap-around)
+	cache.world_to_local_valid = false;
 }
-glm::mat4x3 Scene::Transform::make_world_to_local() const {
+
+void Scene::Transform::update_world_to_local() const {
+	assert(cache.version != 0 && "call update_local_to_world first");
+	if (cache.world_to_local_valid) return;
 	if (!parent) {
-		return make_parent_to_local();
+		cache.world_to_local = make_parent_to_local();
 	} else {
-		return make_parent_to_local() * glm::mat4(parent->make_world_to_local()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		parent->update_world_to_local();
+		compose(make_parent_to_local(), parent->cache.world_to_local, &cache.world_to_local);
+	}
+	cache.world_to_local_valid = true;
+}
+
+//-------------------------
+
+void Scene::build_hierarchy() {
+	std::vector< Transform * > &order = hierarchy.order;
+	std::vector< uint32_t > &parent_index = hierarchy.parent_index;
+
+	//start with transforms in pool order:
+	order.clear();
+	std::vector< uint32_t > slot_to_index(transforms.slots, -1U);
+	for (auto &t : transforms) {
+		slot_to_index[transforms.index_of(&t)] = uint32_t(order.size());
+		order.emplace_back(&t);
+	}
+
+	parent_index.assign(order.size(), Hierarchy::Root);
+	bool sorted = true;
+	for (uint32_t i = 0; i < order.size(); ++i) {
+		if (!order[i]->parent) continue;
+		uint32_t slot = transforms.find(order[i]->parent);
+		parent_index[i] = (slot == -1U ? uint32_t(Hierarchy::External) : slot_to_index[slot]);
+		if (parent_index[i] != Hierarchy::External && parent_index[i] > i) sorted = false;
+	}
+
+	//pool order is usually already parents-first (e.g., when everything came from Scene::load), but if not, sort by depth:
+	if (!sorted) {
+		std::vector< uint32_t > depth(order.size(), -1U);
+		std::vector< uint32_t > chain;
+		for (uint32_t i = 0; i < order.size(); ++i) {
+			//walk up to an ancestor with known depth, then fill in depths on the way back down:
+			uint32_t at = i;
+			while (at < order.size() && depth[at] == -1U) {
+				chain.emplace_back(at);
+				assert(chain.size() <= order.size() && "transform hierarchy should not have cycles");
+				at = parent_index[at];
+			}
+			uint32_t d = (at < order.size() ? depth[at] + 1 : 0);
+			while (!chain.empty()) {
+				depth[chain.back()] = d;
+				d += 1;
+				chain.pop_back();
+			}
+		}
+
+		std::vector< uint32_t > new_index(order.size());
+		std::iota(new_index.begin(), new_index.end(), 0);
+		std::stable_sort(new_index.begin(), new_index.end(), [&depth](uint32_t a, uint32_t b) {
+			return depth[a] < depth[b];
+		});
+		//(new_index is now new position -> old index; invert to remap parent indices)
+		std::vector< uint32_t > old_to_new(order.size());
+		for (uint32_t n = 0; n < new_index.size(); ++n) {
+			old_to_new[new_index[n]] = n;
+		}
+		std::vector< Transform * > new_order(order.size());
+		std::vector< uint32_t > new_parent_index(order.size());
+		for (uint32_t n = 0; n < new_index.size(); ++n) {
+			uint32_t o = new_index[n];
+			new_order[n] = order[o];
+			new_parent_index[n] = (parent_index[o] < order.size() ? old_to_new[parent_index[o]] : parent_index[o]);
+		}
+		order.swap(new_order);
+		parent_index.swap(new_parent_index);
+	}
+
+	hierarchy.parents.resize(order.size());
+	for (uint32_t i = 0; i < order.size(); ++i) {
+		hierarchy.parents[i] = order[i]->parent;
+	}
+	hierarchy.revision = transforms.revision;
+	hierarchy.built = true;
+}
+
+void Scene::update_transforms() {
+	//rebuild the order if transforms have been added, removed, or reparented:
+	bool changed = !hierarchy.built || hierarchy.revision != transforms.revision;
+	for (uint32_t i = 0; !changed && i < hierarchy.order.size(); ++i) {
+		changed = (hierarchy.order[i]->parent != hierarchy.parents[i]);
+	}
+	if (changed) build_hierarchy();
+
+	//forward pass, so every parent is up to date before its children:
+	for (uint32_t i = 0; i < hierarchy.order.size(); ++i) {
+		Transform const &t = *hierarchy.order[i];
+		if (hierarchy.parent_index[i] == Hierarchy::External) {
+			t.parent->update_local_to_world();
+		}
+		t.update_local_to_world_from_parent();
 	}
 }
 
@@ -80,16 +277,167 @@ glm::mat4 Scene::Camera::make_projection() const {
 //-------------------------
 
 
-void Scene::draw(Camera const &camera) const {
+//is any part of the box [min,max] inside the view volume of object_to_clip?
+// (conservative: boxes near frustum corners may be reported as visible)
+static bool box_in_view(glm::mat4 const &object_to_clip, glm::vec3 const &min, glm::vec3 const &max) {
+	glm::vec3 center = 0.5f * (max + min);
+	glm::vec3 radius = 0.5f * (max - min);
+
+	//the view volume is -w <= x,y,z <= w in clip space, so its planes are sums and differences of rows of object_to_clip:
+	glm::vec4 row[4];
+	for (uint32_t r = 0; r < 4; ++r) {
+		row[r] = glm::vec4(object_to_clip[0][r], object_to_clip[1][r], object_to_clip[2][r], object_to_clip[3][r]);
+	}
+	glm::vec4 planes[6] = {
+		row[3] + row[0], row[3] - row[0],
+		row[3] + row[1], row[3] - row[1],
+		row[3] + row[2], row[3] - row[2],
+	};
+
+	for (auto const &plane : planes) {
+		glm::vec3 normal = glm::vec3(plane);
+		//box is entirely outside if even its corner farthest along the plane normal is outside:
+		if (glm::dot(normal, center) + glm::dot(glm::abs(normal), radius) + plane.w < 0.0f) return false;
+	}
+	return true;
+}
+
+Scene::DrawCounts Scene::draw(Camera const &camera) const {
 	assert(camera.transform);
 	glm::mat4 world_to_clip = camera.make_projection() * glm::mat4(camera.transform->make_world_to_local());
 	glm::mat4x3 world_to_light = glm::mat4x3(1.0f);
-	draw(world_to_clip, world_to_light);
+	return draw(world_to_clip, world_to_light);
 }
 
-void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+//sort render queue items by key (least-significant-digit radix sort, 8 bits per pass):
+// uses *scratch_ as temporary storage; skips passes where every key has the same digit
+static void radix_sort(std::vector< Scene::RenderQueue::Item > *items_, std::vector< Scene::RenderQueue::Item > *scratch_) {
+	assert(items_);
+	auto &items = *items_;
+	assert(scratch_);
+	auto &scratch = *scratch_;
+
+	if (items.empty()) return;
+	scratch.resize(items.size());
+	for (uint32_t shift = 0; shift < 64; shift += 8) {
+		uint32_t offsets[256] = {};
+		for (auto const &item : items) {
+			offsets[(item.key >> shift) & 0xff] += 1;
+		}
+		if (offsets[(items[0].key >> shift) & 0xff] == items.size()) continue; //all keys share this digit
+		uint32_t total = 0;
+		for (auto &offset : offsets) {
+			uint32_t count = offset;
+			offset = total;
+			total += count;
+		}
+		for (auto const &item : items) {
+			scratch[offsets[(item.key >> shift) & 0xff]++] = item;
+		}
+		items.swap(scratch);
+	}
+}
+
+//append the indices of the (up to MaxLightsPerDraw strongest) lights that reach the sphere (center, radius) to queue.light_indices:
+// returns the number of indices appended
+static uint32_t gather_lights(Scene::RenderQueue *queue_, glm::vec3 const &center, float radius) {
+	assert(queue_);
+	auto &queue = *queue_;
+
+	//keep the strongest lights seen so far, strongest first:
+	// (strength is estimated at the point of the sphere closest to the light, with the same falloff as the shader)
+	struct Candidate {
+		float strength;
+		GLuint index;
+	};
+	Candidate kept[LightsBlock::MaxLightsPerDraw];
+	uint32_t count = 0;
+
+	for (uint32_t l = 0; l < queue.lights.size(); ++l) {
+		Scene::RenderQueue::LightBounds const &light = queue.lights[l];
+		float strength = light.energy;
+		if (light.radius != std::numeric_limits< float >::infinity()) {
+			float distance = std::max(0.0f, glm::length(light.center - center) - radius);
+			if (distance >= light.radius) continue; //doesn't reach
+			strength /= std::max(1.0f, distance * distance);
+		} else {
+			strength = std::numeric_limits< float >::infinity(); //lights that reach everywhere are always kept
+		}
+
+		if (count == LightsBlock::MaxLightsPerDraw && strength <= kept[count-1].strength) continue;
+		uint32_t at = (count < LightsBlock::MaxLightsPerDraw ? count++ : count - 1);
+		while (at > 0 && kept[at-1].strength < strength) {
+			kept[at] = kept[at-1];
+			at -= 1;
+		}
+		kept[at] = Candidate{strength, l};
+	}
+
+	for (uint32_t i = 0; i < count; ++i) {
+		queue.light_indices.emplace_back(kept[i].index);
+	}
+	return count;
+}
+
+Scene::DrawCounts Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+	DrawCounts counts;
+
+	//--- matrices shared by every draw go in the Camera block, once ---
+	CameraBlock camera_block;
+	camera_block.WORLD_TO_CLIP = world_to_clip;
+	camera_block.WORLD_TO_LIGHT = glm::mat4(world_to_light);
+	camera_block.LIGHT_TO_CLIP = world_to_clip * glm::inverse(glm::mat4(world_to_light));
+	camera_block.upload();
+
+	//--- every light goes in the Lights block, once; draws get lists of the ones that reach them ---
+	LightsBlock lights_block;
+	render_queue.lights.clear();
+	for (auto const &light : lights) {
+		//(any lights past MaxLights are ignored)
+		if (render_queue.lights.size() == LightsBlock::MaxLights) break;
+
+		assert(light.transform); //lights *must* have a transform
+		light.transform->update_local_to_world();
+		glm::mat4x3 const &light_to_world = light.transform->cache.local_to_world;
+		glm::vec3 location = light_to_world[3];
+		glm::vec3 direction = -light_to_world[2]; //lights shine along their -z axis
+
+		float energy = std::max(light.energy.x, std::max(light.energy.y, light.energy.z));
+		if (!(energy > 0.0f)) continue; //(black lights never need to be drawn)
+
+		RenderQueue::LightBounds bounds;
+		bounds.center = location;
+		bounds.energy = energy;
+
+		LightsBlock::Light &out = lights_block.LIGHTS[render_queue.lights.size()];
+		out.LOCATION = glm::vec4(world_to_light * glm::vec4(location, 1.0f), 0.0f);
+		out.DIRECTION = glm::vec4(glm::normalize(glm::mat3(world_to_light) * direction), 0.0f);
+		out.ENERGY = glm::vec4(light.energy, 0.0f);
+		if (light.type == Light::Point) {
+			out.LOCATION.w = 0.0f;
+			bounds.radius = std::sqrt(energy / Light::MinEnergy);
+		} else if (light.type == Light::Hemisphere) {
+			out.LOCATION.w = 1.0f;
+			bounds.radius = std::numeric_limits< float >::infinity();
+		} else if (light.type == Light::Spot) {
+			out.LOCATION.w = 2.0f;
+			out.DIRECTION.w = std::cos(0.5f * light.spot_fov);
+			bounds.radius = std::sqrt(energy / Light::MinEnergy); //(the whole sphere, not just the cone; conservative)
+		} else {
+			assert(light.type == Light::Directional);
+			out.LOCATION.w = 3.0f;
+			bounds.radius = std::numeric_limits< float >::infinity();
+		}
+		render_queue.lights.emplace_back(bounds);
+	}
+	lights_block.LIGHT_COUNT.x = uint32_t(render_queue.lights.size());
+	lights_block.upload();
+	render_queue.light_indices.clear();
+
+	//--- cull drawables and queue up the rest ---
+	render_queue.entries.clear();
+	render_queue.items.clear();
 
-	//Iterate through all drawables, sending each one to OpenGL:
 	for (auto const &drawable : drawables) {
 		//Reference to drawable's pipeline for convenience:
 		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
@@ -101,68 +449,279 @@ void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_lig
 		//skip any drawables that don't contain any vertices:
 		if (pipeline.count == 0) continue;
 
+		//the object-to-world matrix is used for culling and in all three of the uniforms below:
+		assert(drawable.transform); //drawables *must* have a transform
+		drawable.transform->update_local_to_world(); //(cheap if update_transforms already ran: each ancestor is only compared to its cache)
+		glm::mat4x3 const &object_to_world = drawable.transform->cache.local_to_world;
 
-		//Set shader program:
-		glUseProgram(pipeline.program);
+		//skip drawables that have been scaled to nothing (e.g., hidden by setting scale to zero):
+		if (object_to_world[0] == glm::vec3(0.0f) || object_to_world[1] == glm::vec3(0.0f) || object_to_world[2] == glm::vec3(0.0f)) {
+			counts.culled += 1;
+			continue;
+		}
 
-		//Set attribute sources:
-		glBindVertexArray(pipeline.vao);
+		//skip drawables whose bounding box is entirely out of view:
+		glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
+		bool has_bounds = (drawable.min.x <= drawable.max.x);
+		if (has_bounds && !box_in_view(object_to_clip, drawable.min, drawable.max)) {
+			counts.culled += 1;
+			continue;
+		}
+		counts.drawn += 1;
+
+		//sort key, from most- to least-significant bits:
+		//  program (12 bits) | vao (16 bits) | textures (16 bits) | depth (20 bits)
+		// so drawables sharing state end up next to each other, and draw front-to-back within that state
+		// (names are truncated / hashed to fit, which can only make sorting less effective, never incorrect)
+		uint64_t key = 0;
+		key |= uint64_t(pipeline.program & 0xfff) << 52;
+		key |= uint64_t(pipeline.vao & 0xffff) << 36;
+		uint32_t textures = 0;
+		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+			textures = textures * 0x9e3779b1u + pipeline.textures[i].texture;
+		}
+		key |= uint64_t((textures ^ (textures >> 16)) & 0xffff) << 20;
+		//depth is the clip-space z of the box center, whose float bits sort like the float itself when it is positive:
+		glm::vec3 center = (has_bounds ? 0.5f * (drawable.min + drawable.max) : glm::vec3(0.0f));
+		float depth = std::max(0.0f, (object_to_clip * glm::vec4(center, 1.0f)).z);
+		uint32_t depth_bits;
+		static_assert(sizeof(depth_bits) == sizeof(depth), "float is 32 bits.");
+		std::memcpy(&depth_bits, &depth, sizeof(depth));
+		key |= uint64_t(depth_bits >> 11) & 0xfffff;
+
+		render_queue.items.emplace_back(RenderQueue::Item{key, uint32_t(render_queue.entries.size())});
+
+		render_queue.entries.emplace_back();
+		RenderQueue::Entry &entry = render_queue.entries.back();
+		entry.object_to_world = object_to_world;
+		entry.program = pipeline.program;
+		entry.vao = pipeline.vao;
+		entry.type = pipeline.type;
+		entry.start = pipeline.start;
+		entry.count = pipeline.count;
+		entry.OBJECT_TO_CLIP_mat4 = pipeline.OBJECT_TO_CLIP_mat4;
+		entry.OBJECT_TO_LIGHT_mat4x3 = pipeline.OBJECT_TO_LIGHT_mat4x3;
+		entry.NORMAL_TO_LIGHT_mat3 = pipeline.NORMAL_TO_LIGHT_mat3;
+		entry.LIGHT_INDEX_COUNT_uint = pipeline.LIGHT_INDEX_COUNT_uint;
+		entry.LIGHT_INDICES_uint_array = pipeline.LIGHT_INDICES_uint_array;
+		entry.lights_first = uint32_t(render_queue.light_indices.size());
+		entry.lights_count = 0;
+		if (pipeline.LIGHT_INDEX_COUNT_uint != -1U) {
+			//find lights that reach the (world-space bounding sphere of the) bounding box:
+			glm::vec3 world_center = object_to_world * glm::vec4(center, 1.0f);
+			float world_radius = std::numeric_limits< float >::infinity();
+			if (has_bounds) {
+				float scale = std::max(glm::length(object_to_world[0]), std::max(glm::length(object_to_world[1]), glm::length(object_to_world[2])));
+				world_radius = scale * 0.5f * glm::length(drawable.max - drawable.min);
+			}
+			entry.lights_count = gather_lights(&render_queue, world_center, world_radius);
+		}
+		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+			entry.textures[i] = pipeline.textures[i];
+		}
+		entry.set_uniforms = (pipeline.set_uniforms ? &drawable : nullptr);
+	}
 
-		//Configure program uniforms:
+	//--- cull instances and gather matrices for the rest ---
+	render_queue.instance_data.clear();
+	render_queue.batches.clear();
 
-		//the object-to-world matrix is used in all three of these uniforms:
-		assert(drawable.transform); //drawables *must* have a transform
-		glm::mat4x3 object_to_world = drawable.transform->make_local_to_world();
+	for (auto const &inst : instanced) {
+		Scene::Instanced::Pipeline const &pipeline = inst.pipeline;
+
+		//skip, as with drawables, if there is nothing to draw:
+		if (pipeline.program == 0) continue;
+		if (pipeline.vao == 0) continue;
+		if (pipeline.count == 0) continue;
+		assert(pipeline.OBJECT_TO_WORLD_mat4x3 != -1U); //instanced pipelines *must* have somewhere to put instance matrices
+
+		bool has_bounds = (inst.min.x <= inst.max.x);
+		uint32_t first = uint32_t(render_queue.instance_data.size());
+		//world-space box around the bounding spheres of all drawn instances (for finding lights):
+		glm::vec3 local_center = (has_bounds ? 0.5f * (inst.min + inst.max) : glm::vec3(0.0f));
+		float local_radius = (has_bounds ? 0.5f * glm::length(inst.max - inst.min) : 0.0f);
+		glm::vec3 reach_min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 reach_max = glm::vec3(-std::numeric_limits< float >::infinity());
+		for (Transform const *transform : inst.transforms) {
+			assert(transform); //instances *must* have a transform
+			transform->update_local_to_world();
+			glm::mat4x3 const &object_to_world = transform->cache.local_to_world;
+
+			//cull instances the same way as drawables:
+			if (object_to_world[0] == glm::vec3(0.0f) || object_to_world[1] == glm::vec3(0.0f) || object_to_world[2] == glm::vec3(0.0f)) {
+				counts.culled += 1;
+				continue;
+			}
+			if (has_bounds && !box_in_view(world_to_clip * glm::mat4(object_to_world), inst.min, inst.max)) {
+				counts.culled += 1;
+				continue;
+			}
+			counts.drawn += 1;
+
+			render_queue.instance_data.emplace_back(object_to_world);
+
+			if (has_bounds && pipeline.LIGHT_INDEX_COUNT_uint != -1U) {
+				glm::vec3 world_center = object_to_world * glm::vec4(local_center, 1.0f);
+				float scale = std::max(glm::length(object_to_world[0]), std::max(glm::length(object_to_world[1]), glm::length(object_to_world[2])));
+				reach_min = glm::min(reach_min, world_center - glm::vec3(scale * local_radius));
+				reach_max = glm::max(reach_max, world_center + glm::vec3(scale * local_radius));
+			}
+		}
+		uint32_t count = uint32_t(render_queue.instance_data.size()) - first;
+		if (count != 0) {
+			uint32_t lights_first = uint32_t(render_queue.light_indices.size());
+			uint32_t lights_count = 0;
+			if (pipeline.LIGHT_INDEX_COUNT_uint != -1U) {
+				if (has_bounds) {
+					lights_count = gather_lights(&render_queue, 0.5f * (reach_min + reach_max), 0.5f * glm::length(reach_max - reach_min));
+				} else {
+					lights_count = gather_lights(&render_queue, glm::vec3(0.0f), std::numeric_limits< float >::infinity());
+				}
+			}
+			render_queue.batches.emplace_back(RenderQueue::Batch{&inst, first, count, lights_first, lights_count});
+		}
+	}
+
+	//upload all instance matrices at once:
+	if (!render_queue.instance_data.empty()) {
+		if (instance_buffer == 0) glGenBuffers(1, &instance_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+		glBufferData(GL_ARRAY_BUFFER, render_queue.instance_data.size() * sizeof(glm::mat4x3), render_queue.instance_data.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	radix_sort(&render_queue.items, &render_queue.scratch);
+
+	//--- send queued drawables to OpenGL, only changing state that differs from the previous draw ---
+	GLuint current_program = 0;
+	GLuint current_vao = 0;
+	//light list last given to current_program (nearby draws often share lists, so this saves re-uploading them):
+	GLuint const *current_lights = nullptr;
+	uint32_t current_lights_count = -1U;
+	Drawable::Pipeline::TextureInfo current_textures[Drawable::Pipeline::TextureCount];
+	uint32_t active_texture = -1U; //(unknown until first set)
+
+	//change program, vertex array, and texture bindings to match a pipeline, skipping anything already bound:
+	// (texture units the pipeline leaves at zero are un-bound if a previous draw used them)
+	auto set_state = [&](GLuint program, GLuint vao, Drawable::Pipeline::TextureInfo const (&textures)[Drawable::Pipeline::TextureCount]) {
+		if (program != current_program) {
+			glUseProgram(program);
+			current_program = program;
+			current_lights_count = -1U; //(the new program's light uniforms are unknown)
+		}
+		if (vao != current_vao) {
+			glBindVertexArray(vao);
+			current_vao = vao;
+		}
+		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+			auto const &want = textures[i];
+			auto &have = current_textures[i];
+			if (want.texture == have.texture && (want.target == have.target || want.texture == 0)) continue;
+			if (active_texture != i) {
+				glActiveTexture(GL_TEXTURE0 + i);
+				active_texture = i;
+			}
+			if (have.texture != 0 && have.target != want.target) {
+				glBindTexture(have.target, 0);
+			}
+			if (want.texture != 0 || have.target == want.target) {
+				glBindTexture(want.target, want.texture);
+			}
+			have = want;
+		}
+	};
+
+	//set the LIGHT_INDEX_COUNT and LIGHT_INDICES uniforms of the current program, unless they already hold this list:
+	auto set_lights = [&](GLuint LIGHT_INDEX_COUNT_uint, GLuint LIGHT_INDICES_uint_array, uint32_t first, uint32_t count) {
+		if (LIGHT_INDEX_COUNT_uint == -1U) return;
+		GLuint const *indices = render_queue.light_indices.data() + first;
+		if (count == current_lights_count && std::equal(indices, indices + count, current_lights)) return;
+		glUniform1ui(LIGHT_INDEX_COUNT_uint, count);
+		if (count != 0 && LIGHT_INDICES_uint_array != -1U) {
+			glUniform1uiv(LIGHT_INDICES_uint_array, count, indices);
+		}
+		current_lights = indices;
+		current_lights_count = count;
+	};
+
+	for (auto const &item : render_queue.items) {
+		RenderQueue::Entry const &entry = render_queue.entries[item.index];
+
+		//Set shader program, attribute sources, and textures:
+		set_state(entry.program, entry.vao, entry.textures);
+
+		//Configure program uniforms:
 
 		//OBJECT_TO_CLIP takes vertices from object space to clip space:
-		if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
-			glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
-			glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
+		if (entry.OBJECT_TO_CLIP_mat4 != -1U) {
+			glm::mat4 object_to_clip = world_to_clip * glm::mat4(entry.object_to_world);
+			glUniformMatrix4fv(entry.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
 		}
 
 		//the object-to-light matrix is used in the next two uniforms:
-		glm::mat4x3 object_to_light = world_to_light * glm::mat4(object_to_world);
+		glm::mat4x3 object_to_light = world_to_light * glm::mat4(entry.object_to_world);
 
 		//OBJECT_TO_CLIP takes vertices from object space to light space:
-		if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
-			glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
+		if (entry.OBJECT_TO_LIGHT_mat4x3 != -1U) {
+			glUniformMatrix4x3fv(entry.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
 		}
 
 		//NORMAL_TO_CLIP takes normals from object space to light space:
-		if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
+		if (entry.NORMAL_TO_LIGHT_mat3 != -1U) {
 			glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
-			glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+			glUniformMatrix3fv(entry.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
 		}
 
-		//set any requested custom uniforms:
-		if (pipeline.set_uniforms) pipeline.set_uniforms();
+		//LIGHT_INDICES lists the lights that reach the object:
+		set_lights(entry.LIGHT_INDEX_COUNT_uint, entry.LIGHT_INDICES_uint_array, entry.lights_first, entry.lights_count);
 
-		//set up textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, pipeline.textures[i].texture);
-			}
-		}
+		//set any requested custom uniforms:
+		if (entry.set_uniforms) entry.set_uniforms->pipeline.set_uniforms();
 
 		//draw the object:
-		glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
+		glDrawArrays(entry.type, entry.start, entry.count);
+	}
 
-		//un-bind textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, 0);
-			}
+	//--- send instances to OpenGL, one draw call per Instanced ---
+	if (!render_queue.batches.empty()) glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+	for (auto const &batch : render_queue.batches) {
+		Scene::Instanced::Pipeline const &pipeline = batch.instanced->pipeline;
+
+		set_state(pipeline.program, pipeline.vao, pipeline.textures);
+
+		set_lights(pipeline.LIGHT_INDEX_COUNT_uint, pipeline.LIGHT_INDICES_uint_array, batch.lights_first, batch.lights_count);
+
+		//set any requested custom uniforms:
+		if (pipeline.set_uniforms) pipeline.set_uniforms();
+
+		//point the (bound) vertex array's OBJECT_TO_WORLD columns at this batch's matrices, advancing once per instance:
+		for (uint32_t c = 0; c < 4; ++c) {
+			GLuint location = pipeline.OBJECT_TO_WORLD_mat4x3 + c;
+			glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, sizeof(glm::mat4x3), (GLbyte *)0 + batch.first * sizeof(glm::mat4x3) + c * sizeof(glm::vec3));
+			glEnableVertexAttribArray(location);
+			glVertexAttribDivisor(location, 1);
 		}
-		glActiveTexture(GL_TEXTURE0);
 
+		//draw all the instances:
+		glDrawArraysInstanced(pipeline.type, pipeline.start, pipeline.count, batch.count);
 	}
-
+	if (!render_queue.batches.empty()) glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	//un-bind everything, once:
+	for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+		if (current_textures[i].texture != 0) {
+			glActiveTexture(GL_TEXTURE0 + i);
+			active_texture = i;
+			glBindTexture(current_textures[i].target, 0);
+		}
+	}
+	if (active_texture != 0 && active_texture != -1U) glActiveTexture(GL_TEXTURE0);
 	glUseProgram(0);
 	glBindVertexArray(0);
 
 	GL_ERRORS();
+
+	return counts;
 }
 
 
@@ -318,6 +877,13 @@ Scene::Scene(std::string const &filename, std::function< void(Scene &, Transform
 	load(filename, on_drawable);
 }
 
+Scene::~Scene() {
+	if (instance_buffer != 0) {
+		glDeleteBuffers(1, &instance_buffer);
+		instance_buffer = 0;
+	}
+}
+
 Scene::Scene(Scene const &other) {
 	set(other);
 }
@@ -327,51 +893,56 @@ Scene &Scene::operator=(Scene const &other) {
 	return *this;
 }
 
-void Scene::set(Scene const &other, std::unordered_map< Transform const *, Transform * > *transform_map_) {
-
-	std::unordered_map< Transform const *, Transform * > t2t_temp;
-	std::unordered_map< Transform const *, Transform * > &transform_to_transform = *(transform_map_ ? transform_map_ : &t2t_temp);
+void Scene::set(Scene const &other, std::unordered_map< Transform const *, Transform * > *transform_map) {
 
-	transform_to_transform.clear();
+	//Copy transforms (pool copies keep elements in the same slots):
+	transforms = other.transforms;
 
-	//null transform maps to itself:
-	transform_to_transform.insert(std::make_pair(nullptr, nullptr));
-
-	//Copy transforms and store mapping:
-	transforms.clear();
-	for (auto const &t : other.transforms) {
-		transforms.emplace_back();
-		transforms.back().name = t.name;
-		transforms.back().position = t.position;
-		transforms.back().rotation = t.rotation;
-		transforms.back().scale = t.scale;
-		transforms.back().parent = t.parent; //will update later
-
-		//store mapping between transforms old and new:
-		auto ret = transform_to_transform.insert(std::make_pair(&t, &transforms.back()));
-		assert(ret.second);
-	}
+	//the copy of a transform in other is the transform in the same slot here:
+	auto translate = [this, &other](Transform const *t) -> Transform * {
+		if (!t) return nullptr;
+		return transforms.at_index(other.transforms.index_of(t));
+	};
 
 	//update transform parents:
 	for (auto &t : transforms) {
-		t.parent = transform_to_transform.at(t.parent);
+		t.parent = translate(t.parent);
 	}
 
 	//copy other's drawables, updating transform pointers:
 	drawables = other.drawables;
 	for (auto &d : drawables) {
-		d.transform = transform_to_transform.at(d.transform);
+		d.transform = translate(d.transform);
 	}
 
 	//copy other's cameras, updating transform pointers:
 	cameras = other.cameras;
 	for (auto &c : cameras) {
-		c.transform = transform_to_transform.at(c.transform);
+		c.transform = translate(c.transform);
 	}
 
 	//copy other's lights, updating transform pointers:
 	lights = other.lights;
 	for (auto &l : lights) {
-		l.transform = transform_to_transform.at(l.transform);
+		l.transform = translate(l.transform);
+	}
+
+	//copy other's instanced drawables, updating transform pointers:
+	instanced = other.instanced;
+	for (auto &i : instanced) {
+		for (auto &t : i.transforms) {
+			t = translate(t);
+		}
+	}
+
+	//store mapping between transforms old and new, if requested:
+	if (transform_map) {
+		transform_map->clear();
+		//null transform maps to itself:
+		transform_map->insert(std::make_pair(nullptr, nullptr));
+		for (auto const &t : other.transforms) {
+			auto ret = transform_map->insert(std::make_pair(&t, translate(&t)));
+			assert(ret.second);
+		}
 	}
 }
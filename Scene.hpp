@@ -11,13 +11,14 @@
  */
 
 #include "GL.hpp"
+#include "Pool.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
-#include <list>
 #include <memory>
 #include <functional>
+#include <limits>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -40,6 +41,7 @@ struct Scene {
 		glm::mat4x3 make_local_to_parent() const;
 		glm::mat4x3 make_parent_to_local() const;
 		// ..relative to the world:
+		//  (these are cached, and only rebuilt when this transform or one of its ancestors has changed)
 		glm::mat4x3 make_local_to_world() const;
 		glm::mat4x3 make_world_to_local() const;
 
@@ -47,6 +49,30 @@ struct Scene {
 		//Transform(Transform const &) = delete;
 		//if we delete some constructors, we need to let the compiler know that the default constructor is still okay:
 		Transform() = default;
+
+		//--- internals ---
+		//world matrices, along with the values they were built from:
+		// (position, rotation, scale, and parent are set directly, so changes are found by comparing against these)
+		struct Cache {
+			glm::vec3 position;
+			glm::quat rotation;
+			glm::vec3 scale;
+			Transform const *parent = nullptr;
+			uint32_t parent_version = 0; //parent's version when built
+
+			uint32_t version = 0; //incremented whenever local_to_world is rebuilt; 0 means never built
+			glm::mat4x3 local_to_world;
+
+			bool world_to_local_valid = false; //world_to_local is built separately, on request
+			glm::mat4x3 world_to_local;
+		};
+		mutable Cache cache;
+		//bring cache.local_to_world up to date (along with the caches of all ancestors):
+		void update_local_to_world() const;
+		//bring cache.local_to_world up to date, assuming parent's cache already is:
+		void update_local_to_world_from_parent() const;
+		//bring cache.world_to_local up to date (call after update_local_to_world):
+		void update_world_to_local() const;
 	};
 
 	struct Drawable {
@@ -55,6 +81,11 @@ struct Scene {
 		Drawable(Transform *transform_) : transform(transform_) { assert(transform); }
 		Transform * transform;
 
+		//Bounding box of the vertices drawn, in the transform's local space (usually copied from Mesh::min/max):
+		// used by draw to skip drawables that are off-screen; the default (min > max) means "unknown", and is never skipped
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+
 		//Contains all the data needed to run the OpenGL pipeline:
 		struct Pipeline {
 			GLuint program = 0; //shader program; passed to glUseProgram
@@ -70,6 +101,8 @@ struct Scene {
 			GLuint OBJECT_TO_CLIP_mat4 = -1U; //uniform location for object to clip space matrix
 			GLuint OBJECT_TO_LIGHT_mat4x3 = -1U; //uniform location for object to light space (== world space) matrix
 			GLuint NORMAL_TO_LIGHT_mat3 = -1U; //uniform location for normal to light space (== world space) matrix
+			GLuint LIGHT_INDEX_COUNT_uint = -1U; //uniform location for number of lights that reach the object
+			GLuint LIGHT_INDICES_uint_array = -1U; //uniform location for indices (into the "Lights" block) of those lights
 
 			std::function< void() > set_uniforms; //(optional) function to set any other useful uniforms
 
@@ -115,19 +148,61 @@ struct Scene {
 
 		//Spotlight specific:
 		float spot_fov = glm::radians(45.0f); //spot cone fov (in radians)
+
+		//point and spot lights fall off with distance squared, so are treated as reaching only as far as
+		// the distance where they drop below MinEnergy (see draw); hemisphere and directional lights reach everywhere
+		static constexpr float MinEnergy = 1.0f / 256.0f;
+	};
+
+	struct Instanced {
+		//an 'Instanced' draws the same attribute data at many transforms, with one draw call:
+		// (useful for things like projectiles, where there are lots of copies of one mesh)
+		Instanced() = default;
+		std::vector< Transform * > transforms; //one instance is drawn per transform
+
+		//Bounding box of each instance, in its transform's local space (as in Drawable):
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+
+		//Same as Drawable::Pipeline, but object matrices come from a per-instance attribute instead of uniforms:
+		// (so OBJECT_TO_CLIP_mat4, OBJECT_TO_LIGHT_mat4x3, and NORMAL_TO_LIGHT_mat3 are not used)
+		// all instances drawn in a frame share one list of lights (those reaching any of them)
+		// instanced programs get world-to-clip and world-to-light matrices from the "Camera" block (see UniformBlocks.hpp)
+		struct Pipeline : Drawable::Pipeline {
+			//attribute location for object to world space matrix (a mat4x3, so it takes four locations starting here):
+			// the vao should leave it unbound (see MeshBuffer::make_vao_for_program); draw points it at the instance data
+			GLuint OBJECT_TO_WORLD_mat4x3 = -1U;
+		} pipeline;
 	};
 
 	//Scenes, of course, may have many of the above objects:
-	std::list< Transform > transforms;
-	std::list< Drawable > drawables;
-	std::list< Camera > cameras;
-	std::list< Light > lights;
+	// (pools keep pointers to their elements valid, like std::list, but store elements contiguously)
+	Pool< Transform > transforms;
+	Pool< Drawable > drawables;
+	Pool< Camera > cameras;
+	Pool< Light > lights;
+	Pool< Instanced > instanced;
+
+	//Compute the world matrices of all transforms in one forward pass (parents before children):
+	// call after moving things (e.g., at the end of update) so that draw and gameplay code find their matrices already up to date
+	void update_transforms();
 
 	//The "draw" function provides a convenient way to pass all the things in a scene to OpenGL:
-	void draw(Camera const &camera) const;
+	// drawables that are outside the view (by their bounding box) or scaled to zero are skipped ("culled")
+	// the rest are sorted by program, vertex array, and textures (then front-to-back), so state is only changed when it differs
+	// instances are culled individually, and each Instanced is drawn with a single call (counts include instances)
+	struct DrawCounts {
+		uint32_t drawn = 0;
+		uint32_t culled = 0;
+	};
+	DrawCounts draw(Camera const &camera) const;
+
+	// draw also uploads the "Camera" and "Lights" uniform blocks (see UniformBlocks.hpp) for programs that read from them:
+	//  every light goes in the Lights block (up to LightsBlock::MaxLights), and each draw is given the indices of
+	//  the (up to LightsBlock::MaxLightsPerDraw strongest) lights that reach its bounding box
 
 	//..sometimes, you want to draw with a custom projection matrix and/or light space:
-	void draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) const;
+	DrawCounts draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) const;
 
 	//add transforms/objects/cameras from a scene file to this scene:
 	// the 'on_drawable' callback gives your code a chance to look up mesh data and make Drawables:
@@ -142,6 +217,7 @@ struct Scene {
 
 	//empty scene:
 	Scene() = default;
+	virtual ~Scene();
 
 	//load a scene:
 	Scene(std::string const &filename, std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable);
@@ -151,4 +227,62 @@ struct Scene {
 	Scene &operator=(Scene const &); //...as scene = scene
 	//... as a set() function that optionally returns the transform->transform mapping:
 	void set(Scene const &, std::unordered_map< Transform const *, Transform * > *transform_map = nullptr);
+
+	//--- internals ---
+	//transforms in topological order, for update_transforms:
+	// (rebuilt when transforms are added, removed, or reparented)
+	struct Hierarchy {
+		bool built = false;
+		uint32_t revision = 0; //transforms.revision when built
+		std::vector< Transform * > order; //parents before children
+		//index in order of each transform's parent (or Root / External):
+		enum : uint32_t { Root = -1U, External = -2U }; //External: parent is not in this scene's transforms
+		std::vector< uint32_t > parent_index;
+		std::vector< Transform const * > parents; //each transform's parent when built
+	} hierarchy;
+	void build_hierarchy();
+
+	//drawables that survived culling, sorted by state, for draw:
+	// (kept between calls to avoid reallocating)
+	struct RenderQueue {
+		struct Entry {
+			glm::mat4x3 object_to_world; //(object_to_clip is recomputed rather than stored, to keep entries small)
+			//copies of the pipeline fields used when drawing, so sorted (scattered) entries don't also need to visit their drawables:
+			GLuint program, vao;
+			GLenum type;
+			GLuint start, count;
+			GLuint OBJECT_TO_CLIP_mat4, OBJECT_TO_LIGHT_mat4x3, NORMAL_TO_LIGHT_mat3;
+			GLuint LIGHT_INDEX_COUNT_uint, LIGHT_INDICES_uint_array;
+			uint32_t lights_first, lights_count; //range of light_indices
+			Drawable::Pipeline::TextureInfo textures[Drawable::Pipeline::TextureCount];
+			Drawable const *set_uniforms; //drawable whose pipeline.set_uniforms to call (or nullptr)
+		};
+		std::vector< Entry > entries;
+		struct Item {
+			uint64_t key; //sort key (see draw)
+			uint32_t index; //into entries
+		};
+		std::vector< Item > items;
+		std::vector< Item > scratch; //for radix sort
+
+		//object to world matrices of instances that survived culling, grouped by Instanced:
+		std::vector< glm::mat4x3 > instance_data;
+		struct Batch {
+			Instanced const *instanced;
+			uint32_t first, count; //range of instance_data
+			uint32_t lights_first, lights_count; //range of light_indices
+		};
+		std::vector< Batch > batches;
+
+		//world-space extent of each light in the Lights block, for finding the lights that reach each draw:
+		struct LightBounds {
+			glm::vec3 center;
+			float radius; //infinity for lights that reach everywhere
+			float energy; //largest component of energy (used to choose between lights when too many reach a draw)
+		};
+		std::vector< LightBounds > lights;
+		std::vector< GLuint > light_indices; //per-draw lists of lights, uploaded to LIGHT_INDICES
+	};
+	mutable RenderQueue render_queue;
+	mutable GLuint instance_buffer = 0; //render_queue.instance_data is streamed here (created on first use)
 };
@@ -161,6 +161,8 @@ void ShowMeshesMode::select_prev_mesh() {
 		scene_drawable->pipeline.type = f->second.type;
 		scene_drawable->pipeline.start = f->second.start;
 		scene_drawable->pipeline.count = f->second.count;
+		scene_drawable->min = f->second.min;
+		scene_drawable->max = f->second.max;
 		current_mesh_min = f->second.min;
 		current_mesh_max = f->second.max;
 	} else {
@@ -190,6 +192,8 @@ void ShowMeshesMode::select_next_mesh() {
 		scene_drawable->pipeline.type = f->second.type;
 		scene_drawable->pipeline.start = f->second.start;
 		scene_drawable->pipeline.count = f->second.count;
+		scene_drawable->min = f->second.min;
+		scene_drawable->max = f->second.max;
 		current_mesh_min = f->second.min;
 		current_mesh_max = f->second.max;
 	} else {
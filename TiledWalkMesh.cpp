@@ -0,0 +1,249 @@
+#include "TiledWalkMesh.hpp"
+
+#include <glm/gtx/quaternion.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+
+TiledWalkMesh::TiledWalkMesh(std::string const &filename, std::string const &name, float tile_size_)
+	: load_radius(tile_size_), unload_radius(2.0f * tile_size_), file(new WalkMeshFile(filename)), tile_size(tile_size_) {
+	assert(tile_size > 0.0f);
+
+	//find tiles by name:
+	std::string prefix = name + "@";
+	for (auto const &e : file->entries) {
+		if (e.name.compare(0, prefix.size(), prefix) != 0) continue;
+		int x, y;
+		char comma;
+		size_t used = 0;
+		try {
+			std::string coords = e.name.substr(prefix.size());
+			x = std::stoi(coords, &used);
+			comma = coords.at(used);
+			coords = coords.substr(used + 1);
+			y = std::stoi(coords, &used);
+			if (comma != ',' || used != coords.size()) throw std::invalid_argument("extra characters");
+		} catch (std::exception &) {
+			throw std::runtime_error("Walkmesh tile with malformed name '" + e.name + "' in '" + filename + "'");
+		}
+		tiles.emplace_back();
+		tiles.back().coord = glm::ivec2(x, y);
+		tiles.back().vertex_begin = e.vertex_begin;
+		tiles.back().vertex_end = e.vertex_end;
+		tiles.back().triangle_begin = e.triangle_begin;
+		tiles.back().triangle_end = e.triangle_end;
+	}
+	if (tiles.empty()) {
+		throw std::runtime_error("No tiles of walkmesh '" + name + "' in '" + filename + "'");
+	}
+
+	std::sort(tiles.begin(), tiles.end(), [](Tile const &a, Tile const &b) {
+		return a.vertex_begin < b.vertex_begin;
+	});
+	for (uint32_t i = 1; i < tiles.size(); ++i) {
+		if (tiles[i-1].vertex_end > tiles[i].vertex_begin) {
+			throw std::runtime_error("Walkmesh tiles share vertices in '" + filename + "'");
+		}
+	}
+
+	//loader thread builds tiles' walkmeshes (the expensive part of loading) as update() asks for them:
+	loader = std::thread([this](){
+		std::unique_lock< std::mutex > lock(loader_mutex);
+		while (true) {
+			loader_cv.wait(lock, [this](){ return quit || !to_load.empty(); });
+			if (quit) break;
+			uint32_t tile = to_load.back();
+			to_load.pop_back();
+			loading += 1;
+
+			lock.unlock();
+			std::unique_ptr< WalkMesh > walkmesh = build_tile(tile);
+			lock.lock();
+
+			loaded.emplace_back(tile, std::move(walkmesh));
+			loading -= 1;
+			loaded_cv.notify_all();
+		}
+	});
+}
+
+TiledWalkMesh::~TiledWalkMesh() {
+	{
+		std::unique_lock< std::mutex > lock(loader_mutex);
+		quit = true;
+	}
+	loader_cv.notify_all();
+	loader.join();
+}
+
+std::unique_ptr< WalkMesh > TiledWalkMesh::build_tile(uint32_t t) const {
+	Tile const &tile = tiles[t];
+
+	//(triangle indices are made relative to the tile's first vertex)
+	return std::unique_ptr< WalkMesh >(new WalkMesh(
+		file->make_walkmesh(tile.vertex_begin, tile.vertex_end, tile.triangle_begin, tile.triangle_end)
+	));
+}
+
+void TiledWalkMesh::update(glm::vec3 const &focus, bool wait) {
+	//queue tiles near the focus for loading, and unload tiles far from it:
+	std::vector< std::pair< float, uint32_t > > queue; //(distance, tile)
+	for (uint32_t t = 0; t < tiles.size(); ++t) {
+		Tile &tile = tiles[t];
+		//distance (in xy) from focus to the tile's square:
+		glm::vec2 min = glm::vec2(tile.coord) * tile_size;
+		glm::vec2 max = min + glm::vec2(tile_size);
+		glm::vec2 d = glm::max(glm::vec2(0.0f), glm::max(min - glm::vec2(focus), glm::vec2(focus) - max));
+		float dis = glm::length(d);
+
+		if (!tile.walkmesh && !tile.queued && dis <= load_radius) {
+			tile.queued = true;
+			queue.emplace_back(dis, t);
+		} else if (tile.walkmesh && dis > unload_radius) {
+			remove_portals(t);
+			tile.walkmesh.reset();
+		}
+	}
+
+	//(the loader takes tiles from the back of to_load, so queue the nearest tiles last)
+	std::sort(queue.begin(), queue.end(), std::greater< std::pair< float, uint32_t > >());
+
+	std::vector< std::pair< uint32_t, std::unique_ptr< WalkMesh > > > finished;
+	{
+		std::unique_lock< std::mutex > lock(loader_mutex);
+		for (auto const &q : queue) {
+			to_load.emplace_back(q.second);
+		}
+		if (!queue.empty()) loader_cv.notify_all();
+		if (wait) {
+			loaded_cv.wait(lock, [this](){ return to_load.empty() && loading == 0; });
+		}
+		finished.swap(loaded);
+	}
+
+	//make tiles finished by the loader usable:
+	for (auto &f : finished) {
+		Tile &tile = tiles[f.first];
+		assert(tile.queued && !tile.walkmesh);
+		tile.queued = false;
+		tile.walkmesh = std::move(f.second);
+		add_portals(f.first);
+	}
+}
+
+uint32_t TiledWalkMesh::find_tile(uint32_t vertex) const {
+	//last tile starting at or before vertex:
+	auto f = std::upper_bound(tiles.begin(), tiles.end(), vertex, [](uint32_t v, Tile const &tile) {
+		return v < tile.vertex_begin;
+	});
+	assert(f != tiles.begin());
+	--f;
+	assert(vertex < f->vertex_end);
+	return uint32_t(f - tiles.begin());
+}
+
+bool TiledWalkMesh::is_loaded(WalkPoint const &wp) const {
+	return tiles[find_tile(wp.indices.x)].walkmesh != nullptr;
+}
+
+size_t TiledWalkMesh::PortalKeyHash::operator()(PortalKey const &k) const {
+	std::hash< float > h;
+	size_t ret = 0;
+	for (float f : {k.from.x, k.from.y, k.from.z, k.to.x, k.to.y, k.to.z}) {
+		ret = ret * 31 + h(f);
+	}
+	return ret;
+}
+
+void TiledWalkMesh::add_portals(uint32_t t) {
+	WalkMesh const &wm = *tiles[t].walkmesh;
+	for (uint32_t c = 0; c < 3 * wm.triangles.size(); ++c) {
+		if (wm.twin_corner(c) != -1U) continue;
+		glm::uvec3 const &tri = wm.triangles[c / 3];
+		PortalKey key;
+		key.from = wm.vertices[tri[c % 3]];
+		key.to = wm.vertices[tri[(c % 3 + 1) % 3]];
+		portals.emplace(key, Portal{t, c});
+	}
+}
+
+void TiledWalkMesh::remove_portals(uint32_t t) {
+	for (auto p = portals.begin(); p != portals.end(); ) {
+		if (p->second.tile == t) p = portals.erase(p);
+		else ++p;
+	}
+}
+
+WalkPoint TiledWalkMesh::nearest_walk_point(glm::vec3 const &world_point) const {
+	WalkPoint closest;
+	float closest_dis2 = std::numeric_limits< float >::infinity();
+	for (auto const &tile : tiles) {
+		if (!tile.walkmesh) continue;
+		//skip tiles whose bounds are farther than the closest point so far:
+		WalkMesh::BVHNode const &root = tile.walkmesh->bvh_nodes[0];
+		glm::vec3 d = glm::max(glm::vec3(0.0f), glm::max(root.min - world_point, world_point - root.max));
+		if (glm::dot(d, d) > closest_dis2) continue;
+
+		WalkPoint wp = tile.walkmesh->nearest_walk_point(world_point);
+		glm::vec3 to = tile.walkmesh->to_world_point(wp) - world_point;
+		if (glm::dot(to, to) < closest_dis2) {
+			closest_dis2 = glm::dot(to, to);
+			closest = WalkPoint(wp.indices + glm::uvec3(tile.vertex_begin), wp.weights);
+		}
+	}
+	assert(closest_dis2 < std::numeric_limits< float >::infinity() && "Cannot start on a walkmesh with no loaded tiles");
+	return closest;
+}
+
+void TiledWalkMesh::walk_in_triangle(WalkPoint const &start, glm::vec3 const &step, WalkPoint *end, float *time) const {
+	assert(end);
+	Tile const &tile = tiles[find_tile(start.indices.x)];
+	assert(tile.walkmesh && "walkpoint should be on a loaded tile");
+
+	glm::uvec3 offset = glm::uvec3(tile.vertex_begin);
+	tile.walkmesh->walk_in_triangle(WalkPoint(start.indices - offset, start.weights), step, end, time);
+	end->indices += offset;
+}
+
+bool TiledWalkMesh::cross_edge(WalkPoint const &start, WalkPoint *end_, glm::quat *rotation_) const {
+	assert(end_);
+	auto &end = *end_;
+	assert(rotation_);
+	auto &rotation = *rotation_;
+
+	uint32_t t = find_tile(start.indices.x);
+	Tile const &tile = tiles[t];
+	assert(tile.walkmesh && "walkpoint should be on a loaded tile");
+	WalkMesh const &wm = *tile.walkmesh;
+
+	//edges within the tile:
+	glm::uvec3 offset = glm::uvec3(tile.vertex_begin);
+	if (wm.cross_edge(WalkPoint(start.indices - offset, start.weights), &end, &rotation)) {
+		end.indices += offset;
+		return true;
+	}
+
+	//edges between tiles -- look for the same edge, running the other way, in another loaded tile:
+	PortalKey key;
+	key.from = file->vertices[start.indices.y];
+	key.to = file->vertices[start.indices.x];
+	auto range = portals.equal_range(key);
+	for (auto p = range.first; p != range.second; ++p) {
+		if (p->second.tile == t) continue;
+		Tile const &other = tiles[p->second.tile];
+		uint32_t corner = p->second.corner;
+		glm::uvec3 const &tri = other.walkmesh->triangles[corner / 3];
+
+		end.weights = glm::vec3(start.weights.y, start.weights.x, 0.0f);
+		end.indices = glm::uvec3(tri[corner % 3], tri[(corner % 3 + 1) % 3], tri[(corner % 3 + 2) % 3]) + glm::uvec3(other.vertex_begin);
+
+		uint32_t from = wm.find_corner(start.indices.x - tile.vertex_begin, start.indices.y - tile.vertex_begin);
+		assert(from != -1U && "walkpoint should be on a walkmesh triangle");
+		rotation = glm::rotation(wm.triangle_data[from / 3].normal, other.walkmesh->triangle_data[corner / 3].normal);
+		return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+/*
+ * A TiledWalkMesh is a walkmesh that has been cut into square (xy) tiles,
+ *  for levels too big to keep all of their walkmesh in memory at once.
+ *
+ * Tiles are stored as separate walkmeshes in a walkmesh file, named
+ *  "<name>@<x>,<y>" (see scenes/export-walkmeshes.py), and are loaded and
+ *  unloaded on a background thread as the focus (usually the player) moves.
+ *
+ * WalkPoint indices refer to vertices of the whole file, so each WalkPoint
+ *  knows which tile it is on. Boundary edges shared by two loaded tiles are
+ *  linked as "portals", which cross_edge steps over as if they were ordinary
+ *  edges.
+ *
+ */
+
+#include "WalkMesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+struct TiledWalkMesh {
+	//find the tiles of walkmesh 'name' in a walkmesh file (no tiles are loaded until update is called):
+	// tile (x,y) is the one whose triangles have centroids in [x,x+1) * tile_size by [y,y+1) * tile_size
+	TiledWalkMesh(std::string const &filename, std::string const &name, float tile_size);
+	~TiledWalkMesh();
+
+	//tiles closer (in xy) than load_radius to the focus are loaded; tiles farther than unload_radius are unloaded:
+	float load_radius;
+	float unload_radius;
+
+	//call once per frame with the current focus:
+	//  - tiles finished by the loader thread since the last call become usable
+	//  - tiles that should be loaded are queued for the loader thread
+	//  - tiles that should be unloaded are unloaded (NOTE: walkpoints on those tiles become invalid)
+	//  - if wait is true, blocks until all queued tiles are usable (e.g., when placing the player at level start)
+	// Tiles only change during update, so queries between calls always see the same tiles.
+	void update(glm::vec3 const &focus, bool wait = false);
+
+	//is the walkpoint on a loaded tile?
+	bool is_loaded(WalkPoint const &wp) const;
+
+	//closest point on any loaded tile:
+	WalkPoint nearest_walk_point(glm::vec3 const &world_point) const;
+
+	//as in WalkMesh (the walkpoint should be on a loaded tile):
+	void walk_in_triangle(WalkPoint const &start, glm::vec3 const &step, WalkPoint *end, float *time) const;
+
+	//as in WalkMesh, but also crosses tile boundaries when the tile on the other side is loaded:
+	bool cross_edge(WalkPoint const &start, WalkPoint *end, glm::quat *rotation) const;
+
+	//these read the file's data directly, so work even on unloaded tiles:
+	glm::vec3 to_world_point(WalkPoint const &wp) const {
+		return wp.weights.x * file->vertices[wp.indices.x]
+		     + wp.weights.y * file->vertices[wp.indices.y]
+		     + wp.weights.z * file->vertices[wp.indices.z];
+	}
+	glm::vec3 to_world_smooth_normal(WalkPoint const &wp) const {
+		return glm::normalize(
+			  wp.weights.x * file->normals[wp.indices.x]
+			+ wp.weights.y * file->normals[wp.indices.y]
+			+ wp.weights.z * file->normals[wp.indices.z]
+		);
+	}
+	glm::vec3 to_world_triangle_normal(WalkPoint const &wp) const {
+		glm::vec3 const &a = file->vertices[wp.indices.x];
+		glm::vec3 const &b = file->vertices[wp.indices.y];
+		glm::vec3 const &c = file->vertices[wp.indices.z];
+		return glm::normalize( glm::cross( b-a, c-a ) );
+	}
+
+	//--- internals ---
+	std::unique_ptr< WalkMeshFile > file;
+	float tile_size;
+
+	struct Tile {
+		glm::ivec2 coord;
+		uint32_t vertex_begin, vertex_end; //(walkmesh uses vertex indices relative to vertex_begin)
+		uint32_t triangle_begin, triangle_end;
+		std::unique_ptr< WalkMesh > walkmesh; //nullptr if not loaded
+		bool queued = false; //waiting for (or being built by) the loader thread
+	};
+	std::vector< Tile > tiles; //sorted by vertex_begin
+
+	//index of the tile that contains a (file) vertex:
+	uint32_t find_tile(uint32_t vertex) const;
+
+	//build the walkmesh for a tile (run on the loader thread):
+	std::unique_ptr< WalkMesh > build_tile(uint32_t tile) const;
+
+	//boundary half-edges of loaded tiles, by the positions of their endpoints (so the matching edge of the neighboring tile can be found):
+	struct Portal {
+		uint32_t tile;
+		uint32_t corner; //corner (as in WalkMesh::HalfEdge) in the tile's walkmesh
+	};
+	struct PortalKey {
+		glm::vec3 from, to;
+		bool operator==(PortalKey const &o) const { return from == o.from && to == o.to; }
+	};
+	struct PortalKeyHash {
+		size_t operator()(PortalKey const &k) const;
+	};
+	std::unordered_multimap< PortalKey, Portal, PortalKeyHash > portals;
+	void add_portals(uint32_t tile);
+	void remove_portals(uint32_t tile);
+
+	//loader thread and the state it shares (guarded by loader_mutex):
+	std::thread loader;
+	std::mutex loader_mutex;
+	std::condition_variable loader_cv; //signals work to do (or quit) to the loader
+	std::condition_variable loaded_cv; //signals finished tiles to update(..., true)
+	std::vector< uint32_t > to_load;
+	std::vector< std::pair< uint32_t, std::unique_ptr< WalkMesh > > > loaded;
+	uint32_t loading = 0; //tiles taken from to_load but not yet in loaded
+	bool quit = false;
+};
@@ -0,0 +1,76 @@
+#include "UniformBlocks.hpp"
+
+#include <cassert>
+#include <cstddef>
+
+//the C++ structs must match std140 layout exactly:
+static_assert(offsetof(CameraBlock, WORLD_TO_CLIP) == 0, "CameraBlock layout.");
+static_assert(offsetof(CameraBlock, WORLD_TO_LIGHT) == 64, "CameraBlock layout.");
+static_assert(offsetof(CameraBlock, LIGHT_TO_CLIP) == 128, "CameraBlock layout.");
+static_assert(sizeof(LightsBlock::Light) == 48, "LightsBlock::Light is three vec4s (std140 array stride 48).");
+static_assert(offsetof(LightsBlock, LIGHT_COUNT) == 0, "LightsBlock layout.");
+static_assert(offsetof(LightsBlock, LIGHTS) == 16, "LightsBlock layout.");
+
+std::string const CameraBlock::GLSL =
+	"layout(std140) uniform Camera {\n"
+	"	mat4 WORLD_TO_CLIP;\n"
+	"	mat4 WORLD_TO_LIGHT;\n"
+	"	mat4 LIGHT_TO_CLIP;\n"
+	"};\n"
+;
+
+std::string const LightsBlock::GLSL =
+	"struct Light {\n"
+	"	vec4 LOCATION;\n"
+	"	vec4 DIRECTION;\n"
+	"	vec4 ENERGY;\n"
+	"};\n"
+	"layout(std140) uniform Lights {\n"
+	"	uvec4 LIGHT_COUNT;\n"
+	"	Light LIGHTS[" + std::to_string(LightsBlock::MaxLights) + "];\n"
+	"};\n"
+	//(per-draw, so not part of the block; set by Scene::draw)
+	"uniform uint LIGHT_INDEX_COUNT;\n"
+	"uniform uint LIGHT_INDICES[" + std::to_string(LightsBlock::MaxLightsPerDraw) + "];\n"
+;
+
+//(one buffer per block, shared by everything that uploads it)
+static GLuint camera_buffer = 0;
+static GLuint lights_buffer = 0;
+
+//replace the contents of a block's buffer with size bytes (the first data_size of which come from data):
+static void upload_block(GLuint *buffer_, GLuint binding, size_t size, void const *data, size_t data_size) {
+	assert(buffer_);
+	auto &buffer = *buffer_;
+	assert(data_size <= size);
+
+	if (buffer == 0) glGenBuffers(1, &buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	if (data_size == size) {
+		glBufferData(GL_UNIFORM_BUFFER, size, data, GL_STREAM_DRAW);
+	} else {
+		//the whole block must be backed by the buffer, but only the start needs to be sent:
+		glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, data_size, data);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+}
+
+void CameraBlock::upload() const {
+	upload_block(&camera_buffer, Binding, sizeof(*this), this, sizeof(*this));
+}
+
+void LightsBlock::upload() const {
+	assert(LIGHT_COUNT.x <= MaxLights);
+	upload_block(&lights_buffer, Binding, sizeof(*this), this, offsetof(LightsBlock, LIGHTS) + LIGHT_COUNT.x * sizeof(Light));
+}
+
+void bind_uniform_blocks(GLuint program) {
+	GLuint camera_index = glGetUniformBlockIndex(program, "Camera");
+	if (camera_index != GL_INVALID_INDEX) glUniformBlockBinding(program, camera_index, CameraBlock::Binding);
+
+	GLuint lights_index = glGetUniformBlockIndex(program, "Lights");
+	if (lights_index != GL_INVALID_INDEX) glUniformBlockBinding(program, lights_index, LightsBlock::Binding);
+}
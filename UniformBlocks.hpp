@@ -0,0 +1,59 @@
+#pragma once
+
+/*
+ * Uniform blocks hold shader inputs that are the same for every draw in a
+ *  frame (camera matrices, lights). Each block lives in a std140
+ *  uniform buffer that is uploaded once and bound to a fixed binding point,
+ *  so every program that declares the block reads the same data, without
+ *  glUniform* calls on each program.
+ *
+ * To use a block in a shader, paste its GLSL declaration in after the
+ *  #version line, and call bind_uniform_blocks(program) after linking.
+ *
+ */
+
+#include "GL.hpp"
+
+#include <glm/glm.hpp>
+
+#include <string>
+
+//"Camera" block -- uploaded by Scene::draw:
+struct CameraBlock {
+	glm::mat4 WORLD_TO_CLIP = glm::mat4(1.0f);
+	glm::mat4 WORLD_TO_LIGHT = glm::mat4(1.0f); //(mat4 rather than mat4x3, to keep the std140 layout plain; last row unused)
+	glm::mat4 LIGHT_TO_CLIP = glm::mat4(1.0f); //for programs that get per-object OBJECT_TO_LIGHT, so don't need OBJECT_TO_CLIP
+
+	enum : GLuint { Binding = 0 }; //uniform buffer binding point
+	static std::string const GLSL; //declaration of the block, for shader source
+
+	//copy to the block's uniform buffer (creating it on first use) and bind it:
+	void upload() const;
+};
+
+//"Lights" block -- every light in the scene; uploaded by Scene::draw:
+// each draw also gets the (short) list of lights that can reach it, in the LIGHT_INDEX_COUNT and LIGHT_INDICES uniforms
+// which GLSL declares after the block; shaders should only loop over those, not all LIGHT_COUNT.x lights
+struct LightsBlock {
+	glm::uvec4 LIGHT_COUNT = glm::uvec4(0u); //x: number of LIGHTS in use; yzw: unused
+
+	enum : uint32_t { MaxLights = 256 };
+	struct Light {
+		//(type and spot cutoff are packed into w's to keep each light three vec4s)
+		glm::vec4 LOCATION = glm::vec4(0.0f); //xyz: location (point, spot); w: type (0: point, 1: hemisphere, 2: spot, 3: directional)
+		glm::vec4 DIRECTION = glm::vec4(0.0f, 0.0f, -1.0f, 0.0f); //xyz: direction light travels (hemisphere, spot, directional); w: cosine of spot cutoff
+		glm::vec4 ENERGY = glm::vec4(0.0f); //rgb: energy; w: unused
+	} LIGHTS[MaxLights];
+
+	enum : uint32_t { MaxLightsPerDraw = 8 }; //length of the LIGHT_INDICES uniform
+
+	enum : GLuint { Binding = 1 };
+	static std::string const GLSL;
+
+	//copy to the block's uniform buffer (creating it on first use) and bind it:
+	// (only the first LIGHT_COUNT.x lights are copied)
+	void upload() const;
+};
+
+//point program's Camera and Lights blocks (if it declares them) at their binding points:
+void bind_uniform_blocks(GLuint program);
@@ -0,0 +1,91 @@
+#include "WalkCrowd.hpp"
+
+#include "parallel_ranges.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+WalkCrowd::WalkCrowd(WalkMesh const &walkmesh_, float radius_) : radius(radius_), walkmesh(&walkmesh_) {
+	assert(radius > 0.0f);
+}
+
+uint32_t WalkCrowd::bucket_of(glm::ivec2 const &cell) const {
+	uint32_t h = uint32_t(cell.x) * 73856093U ^ uint32_t(cell.y) * 19349663U;
+	//(bucket_begin has an entry per bucket plus one, and the bucket count is a power of two, so masking picks a bucket)
+	uint32_t buckets = uint32_t(bucket_begin.size()) - 1;
+	return h & (buckets - 1);
+}
+
+//push the agents in entries [begin,end) away from their neighbors -- the body of separate, run on one thread:
+static void separate_range(WalkCrowd const &crowd, WalkAgents &agents, uint32_t begin, uint32_t end) {
+	float min_dis = 2.0f * crowd.radius;
+	//(entries are in bucket order, so consecutive entries mostly look at the same neighboring buckets)
+	for (uint32_t i = begin; i < end; ++i) {
+		WalkCrowd::Entry const &e = crowd.entries[i];
+
+		//cells are 2 * radius wide, so every agent close enough to push is in a neighboring cell:
+		glm::vec3 push = glm::vec3(0.0f);
+		for (int32_t dy = -1; dy <= 1; ++dy) {
+			for (int32_t dx = -1; dx <= 1; ++dx) {
+				glm::ivec2 cell = e.cell + glm::ivec2(dx, dy);
+				uint32_t b = crowd.bucket_of(cell);
+				for (uint32_t k = crowd.bucket_begin[b]; k < crowd.bucket_begin[b+1]; ++k) {
+					WalkCrowd::Entry const &other = crowd.entries[k];
+					if (k == i || other.cell != cell) continue;
+					glm::vec3 to = e.position - other.position;
+					float dis2 = glm::dot(to, to);
+					if (dis2 >= min_dis * min_dis) continue;
+					float dis = std::sqrt(dis2);
+					if (dis < 1e-6f * min_dis) {
+						//agents on top of each other; split them (by the full min_dis) in some (arbitrary, but consistent) direction:
+						float angle = 2.39996f * float(std::min(e.agent, other.agent));
+						glm::vec3 dir = glm::vec3(std::cos(angle), std::sin(angle), 0.0f) * (e.agent < other.agent ? 1.0f : -1.0f);
+						push += dir * (0.5f * crowd.strength * min_dis);
+						continue;
+					}
+					//each agent takes half of the push:
+					push += to * (0.5f * crowd.strength * (min_dis - dis) / dis);
+				}
+			}
+		}
+		agents.step_x[e.agent] += push.x;
+		agents.step_y[e.agent] += push.y;
+		agents.step_z[e.agent] += push.z;
+	}
+}
+
+void WalkCrowd::separate(WalkAgents &agents, uint32_t threads) {
+	uint32_t count = agents.size();
+	if (count == 0) return;
+
+	//bucket agents by the (xy) cell, of size 2 * radius, they are in:
+	// (agents stand on the walkmesh, so cells are columns; agents on other floors are skipped by the distance check)
+	float cell_size = 2.0f * radius;
+	uint32_t buckets = 1;
+	while (buckets < 2 * count) buckets *= 2;
+	bucket_begin.assign(buckets + 1, 0);
+	scratch.resize(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		Entry &e = scratch[i];
+		e.position = walkmesh->to_world_point(agents.get(i));
+		e.cell = glm::ivec2(glm::floor(glm::vec2(e.position) / cell_size));
+		e.agent = i;
+		bucket_begin[bucket_of(e.cell)] += 1;
+	}
+	for (uint32_t b = 1; b <= buckets; ++b) {
+		bucket_begin[b] += bucket_begin[b-1];
+	}
+	entries.resize(count);
+	for (uint32_t i = count - 1; i < count; --i) {
+		entries[--bucket_begin[bucket_of(scratch[i].cell)]] = scratch[i];
+	}
+
+	//don't bother spinning up threads for small crowds:
+	constexpr uint32_t MinAgentsPerThread = 1024;
+	threads = std::max(1U, std::min(threads, count / MinAgentsPerThread));
+
+	//each entry only writes its own agent's step, so each thread handles a contiguous slice of entries:
+	parallel_ranges(threads, count, [this,&agents](uint32_t, uint32_t begin, uint32_t end) {
+		separate_range(*this, agents, begin, end);
+	});
+}
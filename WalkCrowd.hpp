@@ -0,0 +1,54 @@
+#pragma once
+
+/*
+ * A WalkCrowd keeps walking agents (WalkAgents) from piling on top of each
+ *  other by adding a separation push to each agent's step before walking.
+ *
+ * Each tick, agents are bucketed by (xy) position into a spatial hash with
+ *  cells the size of an agent's personal space, so each agent only checks the
+ *  agents in the neighboring cells rather than all other agents.
+ *
+ */
+
+#include "WalkMesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+struct WalkCrowd {
+	//agents on walkmesh try to keep at least 2 * radius apart:
+	// NOTE: walkmesh must outlive the crowd.
+	WalkCrowd(WalkMesh const &walkmesh, float radius);
+
+	float radius;
+	//fraction of each overlap pushed apart per call to separate (up to 1.0, which pushes agents just apart in one tick):
+	float strength = 0.5f;
+
+	//add a push away from nearby agents to each agent's step:
+	//  - call after setting steps and before WalkMesh::walk_agents (or use step, below)
+	//  - if threads > 1, large crowds are split across that many worker threads
+	void separate(WalkAgents &agents, uint32_t threads = 1);
+
+	//separate, then walk:
+	void step(WalkAgents &agents, uint32_t threads = 1) {
+		separate(agents, threads);
+		walkmesh->walk_agents(agents, threads);
+	}
+
+	//--- internals ---
+	WalkMesh const *walkmesh;
+
+	//per-tick spatial hash (kept between ticks to avoid reallocating):
+	// agents in bucket b are entries[bucket_begin[b]] .. entries[bucket_begin[b+1]-1], copied in so neighbor checks read contiguous memory;
+	// each entry keeps its cell so agents in other cells that share its bucket can be skipped
+	struct Entry {
+		glm::vec3 position; //world-space
+		glm::ivec2 cell; //xy cell
+		uint32_t agent;
+	};
+	std::vector< Entry > entries;
+	std::vector< uint32_t > bucket_begin;
+	std::vector< Entry > scratch; //entries in agent order, before bucketing
+	uint32_t bucket_of(glm::ivec2 const &cell) const;
+};
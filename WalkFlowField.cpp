@@ -0,0 +1,148 @@
+#include "WalkFlowField.hpp"
+
+#include <queue>
+#include <limits>
+#include <functional>
+
+WalkFlowField::WalkFlowField(WalkMesh const &walkmesh_) : walkmesh(&walkmesh_) {
+	uint32_t count = uint32_t(walkmesh->triangles.size());
+	distance.assign(count, std::numeric_limits< float >::infinity());
+	source.assign(count, -1U);
+	toward.assign(count, glm::vec3(0.0f));
+
+	centroids.reserve(count);
+	for (auto const &tri : walkmesh->triangles) {
+		centroids.emplace_back((walkmesh->vertices[tri.x] + walkmesh->vertices[tri.y] + walkmesh->vertices[tri.z]) / 3.0f);
+	}
+}
+
+uint32_t WalkFlowField::add_source(WalkPoint const &at) {
+	uint32_t id = uint32_t(sources.size());
+	sources.emplace_back();
+	sources.back().position = walkmesh->to_world_point(at);
+	sources.back().triangle = walkmesh->find_triangle(at);
+
+	//seed source's triangle (if the new source is closer than whatever is there now) and flow outward:
+	uint32_t t = sources.back().triangle;
+	float d = glm::length(centroids[t] - sources.back().position);
+	if (d < distance[t]) {
+		distance[t] = d;
+		source[t] = id;
+		toward[t] = sources.back().position;
+		propagate({ std::make_pair(d, t) });
+	}
+
+	return id;
+}
+
+void WalkFlowField::remove_source(uint32_t id) {
+	assert(id < sources.size() && sources[id].triangle != -1U && "source should exist");
+	sources[id].triangle = -1U;
+
+	//forget every triangle that flowed toward the removed source:
+	std::vector< uint32_t > region;
+	for (uint32_t t = 0; t < source.size(); ++t) {
+		if (source[t] == id) {
+			region.emplace_back(t);
+			distance[t] = std::numeric_limits< float >::infinity();
+			source[t] = -1U;
+		}
+	}
+
+	//re-seed the forgotten region from its border with the rest of the field:
+	std::vector< std::pair< float, uint32_t > > seeds;
+	for (uint32_t t : region) {
+		glm::uvec3 const &tri = walkmesh->triangles[t];
+		for (uint32_t i = 0; i < 3; ++i) {
+			uint32_t twin = walkmesh->twin_corner(3*t+i);
+			if (twin == -1U) continue;
+			uint32_t n = twin / 3;
+			if (source[n] == -1U) continue;
+			float d = distance[n] + glm::length(centroids[t] - centroids[n]);
+			if (d < distance[t]) {
+				distance[t] = d;
+				source[t] = source[n];
+				toward[t] = 0.5f * (walkmesh->vertices[tri[i]] + walkmesh->vertices[tri[(i+1)%3]]);
+			}
+		}
+		if (source[t] != -1U) seeds.emplace_back(distance[t], t);
+	}
+
+	//...and from any remaining sources that sit inside the forgotten region:
+	for (uint32_t s = 0; s < sources.size(); ++s) {
+		uint32_t t = sources[s].triangle;
+		if (t == -1U) continue;
+		float d = glm::length(centroids[t] - sources[s].position);
+		if (d < distance[t]) {
+			distance[t] = d;
+			source[t] = s;
+			toward[t] = sources[s].position;
+			seeds.emplace_back(d, t);
+		}
+	}
+
+	propagate(seeds);
+}
+
+void WalkFlowField::propagate(std::vector< std::pair< float, uint32_t > > const &seeds) {
+	typedef std::pair< float, uint32_t > Open; //(distance, triangle)
+	std::priority_queue< Open, std::vector< Open >, std::greater< Open > > open(seeds.begin(), seeds.end());
+
+	while (!open.empty()) {
+		float d = open.top().first;
+		uint32_t t = open.top().second;
+		open.pop();
+		//skip stale queue entries:
+		if (d > distance[t]) continue;
+
+		glm::uvec3 const &tri = walkmesh->triangles[t];
+		for (uint32_t i = 0; i < 3; ++i) {
+			uint32_t twin = walkmesh->twin_corner(3*t+i);
+			if (twin == -1U) continue;
+			uint32_t n = twin / 3;
+			float nd = d + glm::length(centroids[n] - centroids[t]);
+			if (nd < distance[n]) {
+				distance[n] = nd;
+				source[n] = source[t];
+				//walking from n toward t means heading for the middle of their shared edge:
+				toward[n] = 0.5f * (walkmesh->vertices[tri[i]] + walkmesh->vertices[tri[(i+1)%3]]);
+				open.emplace(nd, n);
+			}
+		}
+	}
+}
+
+glm::vec3 WalkFlowField::direction(WalkPoint const &at) const {
+	return direction(walkmesh->find_triangle(at), walkmesh->to_world_point(at));
+}
+
+glm::vec3 WalkFlowField::direction(TriangleWalkPoint const &at) const {
+	return direction(at.triangle, walkmesh->to_world_point(at));
+}
+
+float WalkFlowField::distance_at(WalkPoint const &at) const {
+	return distance_at(walkmesh->find_triangle(at), walkmesh->to_world_point(at));
+}
+
+float WalkFlowField::distance_at(TriangleWalkPoint const &at) const {
+	return distance_at(at.triangle, walkmesh->to_world_point(at));
+}
+
+glm::vec3 WalkFlowField::direction(uint32_t t, glm::vec3 const &position) const {
+	if (source[t] == -1U) return glm::vec3(0.0f);
+
+	glm::vec3 to = toward[t] - position;
+	float len = glm::length(to);
+	if (len < 1e-6f) return glm::vec3(0.0f);
+	return to / len;
+}
+
+float WalkFlowField::distance_at(uint32_t t, glm::vec3 const &position) const {
+	if (source[t] == -1U) return std::numeric_limits< float >::infinity();
+
+	//in a source's own triangle, the distance is just the straight line to the source:
+	if (sources[source[t]].triangle == t) {
+		return glm::length(sources[source[t]].position - position);
+	}
+	return distance[t];
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+/*
+ * A WalkFlowField stores, for every triangle of a WalkMesh, which way to walk
+ *  to reach the nearest of a set of "sources" (targets).
+ *
+ * The field is built by a multi-source Dijkstra pass over the triangle
+ *  adjacency graph, so any number of agents can follow it with a constant-time
+ *  lookup per step (WalkFlowField::direction).
+ *
+ * Adding or removing a source only re-runs Dijkstra over the triangles whose
+ *  nearest source changes.
+ *
+ */
+
+#include "WalkMesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+struct WalkFlowField {
+	//build an (empty) flow field over a walkmesh:
+	// NOTE: walkmesh must outlive the flow field.
+	WalkFlowField(WalkMesh const &walkmesh);
+
+	//add a source for the field to flow toward; returns an id for use with remove_source:
+	uint32_t add_source(WalkPoint const &at);
+	//remove a source (updating only the triangles that flowed toward it):
+	void remove_source(uint32_t id);
+
+	//unit (world-space) direction to walk from a walkpoint, or zero if no source is reachable:
+	glm::vec3 direction(WalkPoint const &at) const;
+
+	//walking distance from a walkpoint to its nearest source (infinity if no source is reachable):
+	float distance_at(WalkPoint const &at) const;
+
+	//as above, for TriangleWalkPoints (which need no triangle lookup):
+	glm::vec3 direction(TriangleWalkPoint const &at) const;
+	float distance_at(TriangleWalkPoint const &at) const;
+
+	//--- internals ---
+	WalkMesh const *walkmesh;
+
+	//direction and distance_at, given the walkpoint's triangle and world position:
+	glm::vec3 direction(uint32_t t, glm::vec3 const &position) const;
+	float distance_at(uint32_t t, glm::vec3 const &position) const;
+
+	//source locations (indexed by id; removed sources have triangle -1U):
+	struct Source {
+		glm::vec3 position;
+		uint32_t triangle;
+	};
+	std::vector< Source > sources;
+
+	//per-triangle field data:
+	std::vector< float > distance; //distance from triangle centroid to nearest source (along centroids), or infinity
+	std::vector< uint32_t > source; //id of nearest source, or -1U if no source is reachable
+	std::vector< glm::vec3 > toward; //point to walk straight toward: midpoint of the edge to the next triangle, or the source itself
+
+	//triangle centroids (cached to keep Dijkstra passes cheap):
+	std::vector< glm::vec3 > centroids;
+
+	//run Dijkstra from the given (triangle, distance) seeds, only relaxing triangles that get closer:
+	void propagate(std::vector< std::pair< float, uint32_t > > const &seeds);
+};
@@ -1,28 +1,406 @@
 #include "WalkMesh.hpp"
 
 #include "read_write_chunk.hpp"
+#include "mapped_file.hpp"
+#include "parallel_ranges.hpp"
 
 #include <glm/gtx/norm.hpp>
 #include <glm/gtx/string_cast.hpp>
 
 #include <iostream>
-#include <fstream>
 #include <algorithm>
 #include <string>
+#include <thread>
+#include <queue>
+#include <cstring>
 
-WalkMesh::WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::vec3 > const &normals_, std::vector< glm::uvec3 > const &triangles_)
-	: vertices(vertices_), normals(normals_), triangles(triangles_) {
+//don't bother spinning up threads for small meshes:
+static constexpr uint32_t MinTrianglesPerThread = 1 << 14;
 
-	//construct next_vertex map (maps each edge to the next vertex in the triangle):
-	next_vertex.reserve(triangles.size()*3);
-	auto do_next = [this](uint32_t a, uint32_t b, uint32_t c) {
-		auto ret = next_vertex.insert(std::make_pair(glm::uvec2(a,b), c));
-		assert(ret.second);
+WalkMesh::WalkMesh(View< glm::vec3 > vertices_, View< glm::vec3 > normals_, View< glm::uvec3 > triangles_, std::shared_ptr< void const > storage_, uint32_t threads)
+	: vertices(vertices_), normals(normals_), triangles(triangles_), storage(storage_) {
+	assert(vertices.size() == normals.size());
+
+	if (!storage) {
+		//no storage given, so copy data into storage owned by this walkmesh (and its copies):
+		struct Owned {
+			std::vector< glm::vec3 > vertices;
+			std::vector< glm::vec3 > normals;
+			std::vector< glm::uvec3 > triangles;
+		};
+		auto owned = std::make_shared< Owned >();
+		owned->vertices.assign(vertices.begin(), vertices.end());
+		owned->normals.assign(normals.begin(), normals.end());
+		owned->triangles.assign(triangles.begin(), triangles.end());
+		vertices = View< glm::vec3 >(owned->vertices);
+		normals = View< glm::vec3 >(owned->normals);
+		triangles = View< glm::uvec3 >(owned->triangles);
+		storage = owned;
+	}
+
+	assert(vertices.size() < (uint64_t(1) << 32) && 3 * triangles.size() < (uint64_t(1) << 32));
+	uint32_t vertex_count = uint32_t(vertices.size());
+	uint32_t triangle_count = uint32_t(triangles.size());
+	uint32_t half_edge_count = 3 * triangle_count;
+	threads = std::max(1U, std::min(threads, triangle_count / MinTrianglesPerThread));
+
+	//construct half-edge adjacency by radix-sorting packed (from, corner) half-edge keys:
+	// (the sorted half-edges leaving each vertex are then contiguous, as half_edges_begin requires)
+	uint32_t vertex_bits = 1;
+	while (vertex_bits < 32 && (uint64_t(1) << vertex_bits) < vertex_count) ++vertex_bits;
+
+	std::vector< uint64_t > keys(half_edge_count);
+	parallel_ranges(threads, triangle_count, [&](uint32_t, uint32_t begin, uint32_t end) {
+		for (uint32_t ti = begin; ti < end; ++ti) {
+			glm::uvec3 const &tri = triangles[ti];
+			assert(tri.x < vertex_count && tri.y < vertex_count && tri.z < vertex_count);
+			for (uint32_t i = 0; i < 3; ++i) {
+				keys[3*ti+i] = (uint64_t(tri[i]) << 32) | uint64_t(3*ti+i);
+			}
+		}
+	});
+
+	{ //stable LSD radix sort of keys by their 'from' part, with each pass split across threads:
+		// (keys start in corner order, so half-edges leaving the same vertex stay in corner order)
+		constexpr uint32_t DigitBits = 11;
+		constexpr uint32_t Digits = 1 << DigitBits;
+		std::vector< uint64_t > keys_out(half_edge_count);
+		std::vector< uint32_t > offsets(threads * Digits);
+		for (uint32_t shift = 32; shift < 32 + vertex_bits; shift += DigitBits) {
+			//count digits in each thread's range:
+			std::fill(offsets.begin(), offsets.end(), 0);
+			parallel_ranges(threads, half_edge_count, [&](uint32_t t, uint32_t begin, uint32_t end) {
+				uint32_t *counts = &offsets[t * Digits];
+				for (uint32_t i = begin; i < end; ++i) {
+					counts[(keys[i] >> shift) & (Digits - 1)] += 1;
+				}
+			});
+			//turn counts into output offsets (by digit, then by thread, so the sort stays stable):
+			uint32_t total = 0;
+			for (uint32_t d = 0; d < Digits; ++d) {
+				for (uint32_t t = 0; t < threads; ++t) {
+					uint32_t count = offsets[t * Digits + d];
+					offsets[t * Digits + d] = total;
+					total += count;
+				}
+			}
+			//scatter:
+			parallel_ranges(threads, half_edge_count, [&](uint32_t t, uint32_t begin, uint32_t end) {
+				uint32_t *next = &offsets[t * Digits];
+				for (uint32_t i = begin; i < end; ++i) {
+					keys_out[next[(keys[i] >> shift) & (Digits - 1)]++] = keys[i];
+				}
+			});
+			keys.swap(keys_out);
+		}
+	}
+
+	//find each vertex's range of half-edges:
+	half_edges_begin.resize(vertex_count + 1);
+	parallel_ranges(threads, half_edge_count + 1, [&](uint32_t, uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i) {
+			//half_edges_begin[v] is i for vertices v after the previous half-edge's 'from', up to this one's:
+			uint32_t from = (i < half_edge_count ? uint32_t(keys[i] >> 32) : vertex_count);
+			for (uint32_t v = (i > 0 ? uint32_t(keys[i-1] >> 32) + 1 : 0); v <= from; ++v) {
+				half_edges_begin[v] = i;
+			}
+		}
+	});
+
+	//read off half-edges, sort each vertex's (small) fan by 'to', and match up any repeated half-edges:
+	half_edges.resize(half_edge_count);
+	std::vector< std::vector< glm::uvec2 > > repeated(threads);
+	parallel_ranges(threads, vertex_count, [&](uint32_t t, uint32_t begin, uint32_t end) {
+		for (uint32_t v = begin; v < end; ++v) {
+			uint32_t fan_begin = half_edges_begin[v];
+			uint32_t fan_end = half_edges_begin[v+1];
+			for (uint32_t i = fan_begin; i < fan_end; ++i) {
+				HalfEdge he;
+				he.corner = uint32_t(keys[i]);
+				he.to = triangles[he.corner / 3][(he.corner % 3 + 1) % 3];
+				//(insertion sort is stable, so repeated half-edges stay in corner order)
+				uint32_t j = i;
+				for (; j > fan_begin && half_edges[j-1].to > he.to; --j) {
+					half_edges[j] = half_edges[j-1];
+				}
+				half_edges[j] = he;
+			}
+			//the same half-edge in more than one triangle means an edge shared by three or more triangles, or inconsistent winding:
+			for (uint32_t i = fan_begin + 1; i < fan_end; ++i) {
+				if (half_edges[i-1].to == half_edges[i].to && (i < fan_begin + 2 || half_edges[i-2].to != half_edges[i].to)) {
+					repeated[t].emplace_back(v, half_edges[i].to);
+				}
+			}
+		}
+	});
+	for (auto const &r : repeated) {
+		non_manifold_edges.insert(non_manifold_edges.end(), r.begin(), r.end());
+	}
+
+	keys = std::vector< uint64_t >();
+
+	//look up each corner's twin once, so crossing edges doesn't need to search:
+	twins.resize(half_edge_count);
+	parallel_ranges(threads, triangle_count, [&](uint32_t, uint32_t begin, uint32_t end) {
+		for (uint32_t c = 3 * begin; c < 3 * end; ++c) {
+			glm::uvec3 const &tri = triangles[c / 3];
+			twins[c] = find_corner(tri[(c % 3 + 1) % 3], tri[c % 3]);
+		}
+	});
+	edge_disabled.assign(half_edge_count, 0);
+	triangle_disabled.assign(triangle_count, 0);
+
+	//precompute per-triangle walking data:
+	triangle_data.resize(triangle_count);
+	parallel_ranges(threads, triangle_count, [&](uint32_t, uint32_t begin, uint32_t end) {
+		for (uint32_t ti = begin; ti < end; ++ti) {
+			glm::uvec3 const &tri = triangles[ti];
+			glm::vec3 const &a = vertices[tri.x];
+			glm::vec3 const &b = vertices[tri.y];
+			glm::vec3 const &c = vertices[tri.z];
+
+			//gradients follow from the barycentric_weights() formulas, rewritten as dot products with the step:
+			glm::vec3 u = b - a;
+			glm::vec3 v = c - a;
+			glm::vec3 n = glm::cross(u, v);
+			float ndot = glm::dot(n, n);
+
+			TriangleData &td = triangle_data[ti];
+			td.gradient[1] = glm::cross(v, n) / ndot;
+			td.gradient[2] = glm::cross(n, u) / ndot;
+			td.gradient[0] = -(td.gradient[1] + td.gradient[2]);
+			for (uint32_t i = 0; i < 3; ++i) {
+				td.inward[i] = glm::normalize(td.gradient[i]);
+			}
+			td.normal = n / std::sqrt(ndot);
+		}
+	});
+
+	//build bvh over triangles by recursively splitting at the median centroid along the longest axis:
+	// (centroids are sorted along with triangle indices, so splitting works on contiguous memory)
+	constexpr uint32_t LeafSize = 4;
+
+	struct Item {
+		glm::vec3 centroid;
+		uint32_t triangle;
 	};
-	for (auto const &tri : triangles) {
-		do_next(tri.x, tri.y, tri.z);
-		do_next(tri.y, tri.z, tri.x);
-		do_next(tri.z, tri.x, tri.y);
+	std::vector< Item > items(triangle_count);
+	parallel_ranges(threads, triangle_count, [&](uint32_t, uint32_t begin, uint32_t end) {
+		for (uint32_t ti = begin; ti < end; ++ti) {
+			glm::uvec3 const &tri = triangles[ti];
+			items[ti].centroid = (vertices[tri.x] + vertices[tri.y] + vertices[tri.z]) / 3.0f;
+			items[ti].triangle = ti;
+		}
+	});
+
+	//split node (if it is big enough), appending its children to nodes; returns true if the node was split:
+	auto split = [&items](std::vector< BVHNode > &nodes, uint32_t ni) -> bool {
+		uint32_t first = nodes[ni].first;
+		uint32_t count = nodes[ni].count;
+		if (count <= LeafSize) return false;
+
+		glm::vec3 cmin = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 cmax = glm::vec3(-std::numeric_limits< float >::infinity());
+		for (uint32_t i = first; i < first + count; ++i) {
+			cmin = glm::min(cmin, items[i].centroid);
+			cmax = glm::max(cmax, items[i].centroid);
+		}
+
+		glm::vec3 extent = cmax - cmin;
+		uint32_t axis = 0;
+		if (extent.y > extent[axis]) axis = 1;
+		if (extent.z > extent[axis]) axis = 2;
+
+		uint32_t half = count / 2;
+		std::nth_element(items.begin() + first, items.begin() + first + half, items.begin() + first + count,
+			[axis](Item const &a, Item const &b) {
+				return a.centroid[axis] < b.centroid[axis];
+			}
+		);
+
+		//split node into two children (stored adjacently):
+		uint32_t ci = uint32_t(nodes.size());
+		nodes.emplace_back();
+		nodes.back().first = first;
+		nodes.back().count = half;
+		nodes.emplace_back();
+		nodes.back().first = first + half;
+		nodes.back().count = count - half;
+
+		nodes[ni].first = ci;
+		nodes[ni].count = 0;
+		return true;
+	};
+
+	//fully split the subtree below nodes[root]:
+	auto build = [&split](std::vector< BVHNode > &nodes, uint32_t root) {
+		std::vector< uint32_t > to_split;
+		to_split.emplace_back(root);
+		while (!to_split.empty()) {
+			uint32_t ni = to_split.back();
+			to_split.pop_back();
+			if (split(nodes, ni)) {
+				to_split.emplace_back(nodes[ni].first);
+				to_split.emplace_back(nodes[ni].first + 1);
+			}
+		}
+	};
+
+	bvh_nodes.reserve(2 * (triangle_count / LeafSize + 1));
+	bvh_nodes.emplace_back();
+	bvh_nodes.back().count = triangle_count;
+
+	if (threads == 1) {
+		build(bvh_nodes, 0);
+	} else {
+		//split the top of the tree breadth-first until there are plenty of subtrees to go around:
+		std::vector< uint32_t > frontier;
+		frontier.emplace_back(0);
+		while (frontier.size() < 4 * threads) {
+			std::vector< uint32_t > next;
+			for (uint32_t ni : frontier) {
+				if (split(bvh_nodes, ni)) {
+					next.emplace_back(bvh_nodes[ni].first);
+					next.emplace_back(bvh_nodes[ni].first + 1);
+				}
+			}
+			if (next.empty()) break;
+			frontier = std::move(next);
+		}
+
+		//...build those subtrees in parallel (each in its own array, rooted at index 0)...
+		std::vector< std::vector< BVHNode > > subtrees(frontier.size());
+		parallel_ranges(threads, uint32_t(frontier.size()), [&](uint32_t, uint32_t begin, uint32_t end) {
+			for (uint32_t f = begin; f < end; ++f) {
+				subtrees[f].emplace_back(bvh_nodes[frontier[f]]);
+				build(subtrees[f], 0);
+			}
+		});
+
+		//...and append them to the tree:
+		for (uint32_t f = 0; f < frontier.size(); ++f) {
+			std::vector< BVHNode > const &sub = subtrees[f];
+			//subtree node i (for i > 0) ends up at base + i - 1:
+			uint32_t base = uint32_t(bvh_nodes.size());
+			for (uint32_t i = 0; i < sub.size(); ++i) {
+				BVHNode node = sub[i];
+				if (node.count == 0) node.first = base + node.first - 1;
+				if (i == 0) bvh_nodes[frontier[f]] = node;
+				else bvh_nodes.emplace_back(node);
+			}
+		}
+	}
+
+	bvh_triangles.resize(triangle_count);
+	for (uint32_t i = 0; i < triangle_count; ++i) {
+		bvh_triangles[i] = items[i].triangle;
+	}
+	items = std::vector< Item >();
+
+	//compute node bounds from the bottom up (children are always stored after their parents):
+	for (uint32_t ni = uint32_t(bvh_nodes.size()) - 1; ni < bvh_nodes.size(); --ni) {
+		BVHNode &node = bvh_nodes[ni];
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+		if (node.count == 0) {
+			for (BVHNode const &child : {bvh_nodes[node.first], bvh_nodes[node.first + 1]}) {
+				min = glm::min(min, child.min);
+				max = glm::max(max, child.max);
+			}
+		} else {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				glm::uvec3 const &tri = triangles[bvh_triangles[i]];
+				for (uint32_t v : {tri.x, tri.y, tri.z}) {
+					min = glm::min(min, vertices[v]);
+					max = glm::max(max, vertices[v]);
+				}
+			}
+		}
+		node.min = min;
+		node.max = max;
+	}
+
+	//build grid:
+	{
+		//triangles with xy area, and their xy bounds:
+		auto xy_area = [this](glm::uvec3 const &tri) {
+			glm::vec2 a = glm::vec2(vertices[tri.x]);
+			glm::vec2 b = glm::vec2(vertices[tri.y]);
+			glm::vec2 c = glm::vec2(vertices[tri.z]);
+			glm::vec2 ab = b - a;
+			glm::vec2 ac = c - a;
+			return ab.x * ac.y - ab.y * ac.x;
+		};
+		glm::vec2 min = glm::vec2( std::numeric_limits< float >::infinity());
+		glm::vec2 max = glm::vec2(-std::numeric_limits< float >::infinity());
+		uint32_t flat_count = 0;
+		double total_size = 0.0; //sum of triangles' xy bounds sizes
+		for (auto const &tri : triangles) {
+			if (xy_area(tri) == 0.0f) continue;
+			flat_count += 1;
+			glm::vec2 tmin = glm::vec2( std::numeric_limits< float >::infinity());
+			glm::vec2 tmax = glm::vec2(-std::numeric_limits< float >::infinity());
+			for (uint32_t v : {tri.x, tri.y, tri.z}) {
+				tmin = glm::min(tmin, glm::vec2(vertices[v]));
+				tmax = glm::max(tmax, glm::vec2(vertices[v]));
+			}
+			total_size += std::max(tmax.x - tmin.x, tmax.y - tmin.y);
+			min = glm::min(min, tmin);
+			max = glm::max(max, tmax);
+		}
+
+		if (flat_count != 0) {
+			//size cells to fit a typical triangle, so each triangle lands in only a few cells:
+			glm::vec2 extent = max - min;
+			float cell_size = float(total_size / flat_count);
+			//(but with no more cells than triangles, so sparse walkmeshes don't waste memory on empty cells)
+			cell_size = std::max(cell_size, std::sqrt(extent.x * extent.y / flat_count));
+			cell_size = std::max(cell_size, std::max(extent.x, extent.y) / flat_count);
+			if (!(cell_size > 0.0f)) cell_size = 1.0f;
+
+			grid_min = min;
+			grid_cell_size = cell_size;
+			grid_size = glm::uvec2(glm::floor(extent / cell_size)) + glm::uvec2(1);
+
+			//cell range [lo, hi] touched by a triangle's xy bounds:
+			auto cells = [this](glm::uvec3 const &tri, glm::uvec2 *lo, glm::uvec2 *hi) {
+				glm::vec2 a = glm::vec2(vertices[tri.x]);
+				glm::vec2 b = glm::vec2(vertices[tri.y]);
+				glm::vec2 c = glm::vec2(vertices[tri.z]);
+				glm::vec2 tmin = (glm::min(a, glm::min(b, c)) - grid_min) / grid_cell_size;
+				glm::vec2 tmax = (glm::max(a, glm::max(b, c)) - grid_min) / grid_cell_size;
+				*lo = glm::min(glm::uvec2(tmin), grid_size - glm::uvec2(1));
+				*hi = glm::min(glm::uvec2(tmax), grid_size - glm::uvec2(1));
+			};
+
+			//count triangles per cell, then prefix-sum into ranges, then fill ranges (counting down from the end of each):
+			grid_cells_begin.assign(grid_size.x * grid_size.y + 1, 0);
+			for (auto const &tri : triangles) {
+				if (xy_area(tri) == 0.0f) continue;
+				glm::uvec2 lo, hi;
+				cells(tri, &lo, &hi);
+				for (uint32_t y = lo.y; y <= hi.y; ++y) {
+					for (uint32_t x = lo.x; x <= hi.x; ++x) {
+						grid_cells_begin[y * grid_size.x + x] += 1;
+					}
+				}
+			}
+			for (uint32_t c = 1; c < grid_cells_begin.size(); ++c) {
+				grid_cells_begin[c] += grid_cells_begin[c-1];
+			}
+			grid_triangles.resize(grid_cells_begin.back());
+			for (uint32_t ti = triangle_count - 1; ti < triangle_count; --ti) {
+				if (xy_area(triangles[ti]) == 0.0f) continue;
+				glm::uvec2 lo, hi;
+				cells(triangles[ti], &lo, &hi);
+				for (uint32_t y = lo.y; y <= hi.y; ++y) {
+					for (uint32_t x = lo.x; x <= hi.x; ++x) {
+						grid_triangles[--grid_cells_begin[y * grid_size.x + x]] = ti;
+					}
+				}
+			}
+			//(each cell's triangles are now in increasing index order)
+		}
 	}
 
 	//DEBUG: are vertex normals consistent with geometric normals?
@@ -53,151 +431,214 @@ glm::vec3 barycentric_weights(glm::vec3 const &a, glm::vec3 const &b, glm::vec3
 	return glm::vec3(x, y, z);
 }
 
-WalkPoint WalkMesh::nearest_walk_point(glm::vec3 const &world_point) const {
-	assert(!triangles.empty() && "Cannot start on an empty walkmesh");
+//find the closest point to pt on triangle tri (with vertex positions a, b, c), returning squared distance:
+// (when the closest point is on an edge, 'closest' is arranged so that weights.z is 0.0)
+static float closest_on_triangle(glm::vec3 const &a, glm::vec3 const &b, glm::vec3 const &c, glm::uvec3 const &tri, glm::vec3 const &world_point, WalkPoint *closest_) {
+	assert(closest_);
+	auto &closest = *closest_;
 
-	WalkPoint closest;
+	//get barycentric coordinates of closest point in the plane of (a,b,c):
+	glm::vec3 coords = barycentric_weights(a,b,c, world_point);
+
+	//is that point inside the triangle?
+	if (coords.x >= 0.0f && coords.y >= 0.0f && coords.z >= 0.0f) {
+		//yes, point is inside triangle.
+		closest.indices = tri;
+		closest.weights = coords;
+		return glm::length2(world_point - (coords.x * a + coords.y * b + coords.z * c));
+	}
+
+	//check triangle vertices and edges:
 	float closest_dis2 = std::numeric_limits< float >::infinity();
+	auto check_edge = [&world_point, &closest, &closest_dis2](glm::vec3 const &a, glm::vec3 const &b, uint32_t ai, uint32_t bi, uint32_t ci) {
+		//find closest point on line segment ab:
+		float along = glm::dot(world_point-a, b-a);
+		float max = glm::dot(b-a, b-a);
+		glm::vec3 pt;
+		glm::vec3 coords;
+		if (along < 0.0f) {
+			pt = a;
+			coords = glm::vec3(1.0f, 0.0f, 0.0f);
+		} else if (along > max) {
+			pt = b;
+			coords = glm::vec3(0.0f, 1.0f, 0.0f);
+		} else {
+			float amt = along / max;
+			pt = glm::mix(a, b, amt);
+			coords = glm::vec3(1.0f - amt, amt, 0.0f);
+		}
 
-	for (auto const &tri : triangles) {
-		//find closest point on triangle:
+		float dis2 = glm::length2(world_point - pt);
+		if (dis2 < closest_dis2) {
+			closest_dis2 = dis2;
+			closest.indices = glm::uvec3(ai, bi, ci);
+			closest.weights = coords;
+		}
+	};
+	check_edge(a, b, tri.x, tri.y, tri.z);
+	check_edge(b, c, tri.y, tri.z, tri.x);
+	check_edge(c, a, tri.z, tri.x, tri.y);
+	return closest_dis2;
+}
 
-		glm::vec3 const &a = vertices[tri.x];
-		glm::vec3 const &b = vertices[tri.y];
-		glm::vec3 const &c = vertices[tri.z];
+//squared distance from pt to an axis-aligned box:
+static float box_dis2(glm::vec3 const &min, glm::vec3 const &max, glm::vec3 const &pt) {
+	glm::vec3 d = glm::max(glm::vec3(0.0f), glm::max(min - pt, pt - max));
+	return glm::dot(d, d);
+}
 
-		//get barycentric coordinates of closest point in the plane of (a,b,c):
-		glm::vec3 coords = barycentric_weights(a,b,c, world_point);
+//depth-first traversal of wm's bvh, visiting nearer child first and skipping nodes farther than the current closest point:
+// *closest, *closest_dis2, and *closest_triangle hold the best point found so far (if any) and are updated in place
+// NOTE: ties are broken toward the lower triangle index so results match a front-to-back scan of 'triangles'
+static void nearest_in_bvh(WalkMesh const &wm, glm::vec3 const &world_point, WalkPoint *closest, float *closest_dis2, uint32_t *closest_triangle) {
+	constexpr uint32_t StackSize = 64;
+	uint32_t stack[StackSize];
+	uint32_t stack_size = 0;
+	stack[stack_size++] = 0;
+	while (stack_size > 0) {
+		WalkMesh::BVHNode const &node = wm.bvh_nodes[stack[--stack_size]];
+		if (box_dis2(node.min, node.max, world_point) > *closest_dis2) continue;
 
-		//is that point inside the triangle?
-		if (coords.x >= 0.0f && coords.y >= 0.0f && coords.z >= 0.0f) {
-			//yes, point is inside triangle.
-			float dis2 = glm::length2(world_point - to_world_point(WalkPoint(tri, coords)));
-			if (dis2 < closest_dis2) {
-				closest_dis2 = dis2;
-				closest.indices = tri;
-				closest.weights = coords;
+		if (node.count != 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				uint32_t ti = wm.bvh_triangles[i];
+				if (wm.triangle_disabled[ti]) continue;
+				WalkPoint wp;
+				glm::uvec3 const &tri = wm.triangles[ti];
+				float dis2 = closest_on_triangle(wm.vertices[tri.x], wm.vertices[tri.y], wm.vertices[tri.z], tri, world_point, &wp);
+				if (dis2 < *closest_dis2 || (dis2 == *closest_dis2 && ti < *closest_triangle)) {
+					*closest_dis2 = dis2;
+					*closest_triangle = ti;
+					*closest = wp;
+				}
 			}
 		} else {
-			//check triangle vertices and edges:
-			auto check_edge = [&world_point, &closest, &closest_dis2, this](uint32_t ai, uint32_t bi, uint32_t ci) {
-				glm::vec3 const &a = vertices[ai];
-				glm::vec3 const &b = vertices[bi];
-
-				//find closest point on line segment ab:
-				float along = glm::dot(world_point-a, b-a);
-				float max = glm::dot(b-a, b-a);
-				glm::vec3 pt;
-				glm::vec3 coords;
-				if (along < 0.0f) {
-					pt = a;
-					coords = glm::vec3(1.0f, 0.0f, 0.0f);
-				} else if (along > max) {
-					pt = b;
-					coords = glm::vec3(0.0f, 1.0f, 0.0f);
-				} else {
-					float amt = along / max;
-					pt = glm::mix(a, b, amt);
-					coords = glm::vec3(1.0f - amt, amt, 0.0f);
-				}
-
-				float dis2 = glm::length2(world_point - pt);
-				if (dis2 < closest_dis2) {
-					closest_dis2 = dis2;
-					closest.indices = glm::uvec3(ai, bi, ci);
-					closest.weights = coords;
-				}
-			};
-			check_edge(tri.x, tri.y, tri.z);
-			check_edge(tri.y, tri.z, tri.x);
-			check_edge(tri.z, tri.x, tri.y);
+			assert(stack_size + 2 <= StackSize);
+			WalkMesh::BVHNode const &a = wm.bvh_nodes[node.first];
+			WalkMesh::BVHNode const &b = wm.bvh_nodes[node.first + 1];
+			//push farther child first so nearer child is visited first:
+			if (box_dis2(a.min, a.max, world_point) < box_dis2(b.min, b.max, world_point)) {
+				stack[stack_size++] = node.first + 1;
+				stack[stack_size++] = node.first;
+			} else {
+				stack[stack_size++] = node.first;
+				stack[stack_size++] = node.first + 1;
+			}
 		}
 	}
+}
+
+WalkPoint WalkMesh::nearest_walk_point(glm::vec3 const &world_point) const {
+	assert(!triangles.empty() && "Cannot start on an empty walkmesh");
+
+	WalkPoint closest;
+	float closest_dis2 = std::numeric_limits< float >::infinity();
+	uint32_t closest_triangle = -1U;
+	nearest_in_bvh(*this, world_point, &closest, &closest_dis2, &closest_triangle);
+	assert(closest_triangle != -1U && "Cannot start on a walkmesh with every triangle disabled");
+
 	assert(closest.indices.x < vertices.size());
 	assert(closest.indices.y < vertices.size());
 	assert(closest.indices.z < vertices.size());
 	return closest;
 }
 
+WalkPoint WalkMesh::nearest_walk_point(glm::vec3 const &world_point, WalkPoint const &hint) const {
+	//walk downhill (in distance to world_point) from the hint's triangle to neighboring triangles:
+	// each move is to a strictly closer triangle (or an equally close one with lower index), so this can't loop
+	constexpr uint32_t MaxMoves = 16;
+
+	uint32_t closest_triangle = find_triangle(hint);
+	if (triangle_disabled[closest_triangle]) return nearest_walk_point(world_point);
+	WalkPoint closest;
+	glm::uvec3 const &start = triangles[closest_triangle];
+	float closest_dis2 = closest_on_triangle(vertices[start.x], vertices[start.y], vertices[start.z], start, world_point, &closest);
+
+	for (uint32_t move = 0; move < MaxMoves; ++move) {
+		uint32_t next = -1U;
+		auto check = [&](uint32_t ti) {
+			WalkPoint wp;
+			glm::uvec3 const &tri = triangles[ti];
+			float dis2 = closest_on_triangle(vertices[tri.x], vertices[tri.y], vertices[tri.z], tri, world_point, &wp);
+			if (dis2 < closest_dis2 || (dis2 == closest_dis2 && ti < closest_triangle)) {
+				closest_dis2 = dis2;
+				closest = wp;
+				next = ti;
+			}
+		};
+
+		//triangles across each edge:
+		for (uint32_t i = 0; i < 3; ++i) {
+			uint32_t twin = twin_corner(3 * closest_triangle + i);
+			if (twin != -1U) check(twin / 3);
+		}
+		//if the closest point is a vertex, any triangle around it might be closer:
+		// (closest_on_triangle puts points on edges on the edge indices.x -> indices.y)
+		if (closest.weights.z == 0.0f && (closest.weights.x == 1.0f || closest.weights.y == 1.0f)) {
+			uint32_t v = (closest.weights.x == 1.0f ? closest.indices.x : closest.indices.y);
+			for (uint32_t i = half_edges_begin[v]; i < half_edges_begin[v+1]; ++i) {
+				if (!triangle_disabled[half_edges[i].corner / 3]) check(half_edges[i].corner / 3);
+			}
+		}
+
+		//no neighbor is closer, so this is the closest point on the surface around the hint:
+		if (next == -1U) return closest;
+		closest_triangle = next;
+	}
+
+	//world_point is too far from the hint for walking to find it quickly, so fall back to the bvh:
+	// (the best point so far still lets the bvh skip everything farther away)
+	nearest_in_bvh(*this, world_point, &closest, &closest_dis2, &closest_triangle);
+	return closest;
+}
 
 void WalkMesh::walk_in_triangle(WalkPoint const &start, glm::vec3 const &step, WalkPoint *end_, float *time_) const {
 	assert(end_);
 	auto &end = *end_;
 	assert(time_);
 	auto &time = *time_;
-//!todo{
-	glm::vec3 const &a = vertices[start.indices.x];
-	glm::vec3 const &b = vertices[start.indices.y];
-	glm::vec3 const &c = vertices[start.indices.z];
 
-	//TODO: transform 'step' into a barycentric velocity on (a,b,c)
+	//look up precomputed data for the triangle, and which of its vertices is start.indices.x:
+	uint32_t corner = find_corner(start.indices.x, start.indices.y);
+	assert(corner != -1U && "walkpoint should be on a walkmesh triangle");
+	TriangleData const &td = triangle_data[corner / 3];
+	uint32_t r = corner % 3;
+
+	//transform 'step' into a barycentric velocity on (a,b,c):
+	glm::vec3 bv = glm::vec3(
+		glm::dot(step, td.gradient[r]),
+		glm::dot(step, td.gradient[(r+1)%3]),
+		glm::dot(step, td.gradient[(r+2)%3])
+	);
+
+	//time at which each weight would reach zero:
+	glm::vec3 t = -start.weights / bv;
+
+	float lowest = 1.0f;
+	int cased = -1;
+	for (int i = 0; i < 3; ++i) {
+		if (t[i] < lowest && t[i] > 0.0f) {
+			cased = i;
+			lowest = t[i];
+		}
+	}
 
-	glm::uvec3 indices = start.indices;
-	glm::vec3 cart = a * start.weights[0] + b * start.weights[1] + c * start.weights[2];
-	
-	auto bw = [](glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 pt) {
-//!todo{
-		//compute barycentric weights here!
-		auto u = b - a;
-		auto v = c - a;
-		auto n = cross(u, v);
-		auto d = pt - a;
-		auto ndot = dot(n, n);
-		auto z = dot(cross(u, d), n) / ndot;
-		auto y = dot(n, cross(d, v)) / ndot;
-		auto x = 1 - z - y;
-		return glm::vec3(x, y, z);
-	};
-	
-	auto barys = bw(a, b, c, cart + step);
-	auto bv = barys - start.weights;
-	
-	auto w1 = - start.weights.x / bv[0];
-	auto w2 = - start.weights.y / bv[1];
-	auto w3 = - start.weights.z / bv[2];
-	
-	
-	//printf("%f, %f, %f\n", w1, w2, w3);
-	
-	float lowest = 1.0f; 
-	int cased = 0;
-	if (w1 < lowest && w1 > 0) {
-		cased = 0;
-		lowest = w1;
-	}
-	if (w2 < lowest && w2 > 0) {
-		cased = 1;
-		lowest = w2;
-	}
-	if (w3 < lowest && w3 > 0) {
-		cased = 2;
-		lowest = w3;
-	}
-	
 	time = lowest;
 	glm::vec3 finals = start.weights + bv * lowest;
-	
-	if (cased == 0) {
-		end.weights.x = finals.y;
-		end.weights.y = finals.z;
-		end.weights.z = abs(finals.x);
-		end.indices.x = indices.y;
-		end.indices.y = indices.z;
-		end.indices.z = indices.x;
+
+	if (cased == -1) {
+		//whole step stays within the triangle:
+		end.indices = start.indices;
+		end.weights = finals;
+	} else if (cased == 0) {
+		end.weights = glm::vec3(finals.y, finals.z, 0.0f);
+		end.indices = glm::uvec3(start.indices.y, start.indices.z, start.indices.x);
 	} else if (cased == 1) {
-		end.weights.x = finals.z;
-		end.weights.y = finals.x;
-		end.weights.z = 0.0f;
-		end.indices.x = indices.z;
-		end.indices.y = indices.x;
-		end.indices.z = indices.y;
-	} else if (cased == 2) {
-		end.weights.x = finals.x;
-		end.weights.y = finals.y;
-		end.weights.z = 0.0f;
-		end.indices.x = indices.x;
-		end.indices.y = indices.y;
-		end.indices.z = indices.z;
+		end.weights = glm::vec3(finals.z, finals.x, 0.0f);
+		end.indices = glm::uvec3(start.indices.z, start.indices.x, start.indices.y);
+	} else { //cased == 2
+		end.weights = glm::vec3(finals.x, finals.y, 0.0f);
+		end.indices = start.indices;
 	}
 }
 
@@ -210,55 +651,970 @@ bool WalkMesh::cross_edge(WalkPoint const &start, WalkPoint *end_, glm::quat *ro
 	auto &rotation = *rotation_;
 //!todo{
 
-	//TODO: check if edge (start.indices.x, start.indices.y) has a triangle on the other side:
-	//  hint: remember 'next_vertex'!
-	auto next = next_vertex.find(glm::vec2(start.indices.y, start.indices.x));
-	if (next == next_vertex.end()) {
+	//check if edge (start.indices.x, start.indices.y) has a triangle on the other side:
+	// (twins already account for disabled edges and triangles, so they cost nothing extra here)
+	uint32_t corner = find_corner(start.indices.x, start.indices.y);
+	assert(corner != -1U && "walkpoint should be on a walkmesh triangle");
+	uint32_t other = twins[corner];
+	if (other == -1U) {
 		return false;
 	}
-	
-	//TODO: if there is another triangle:
-	//  TODO: set end's weights and indicies on that triangle:
+
+	//if there is another triangle, set end's weights and indices on that triangle:
 	end.weights.x = start.weights.y;
 	end.weights.y = start.weights.x;
 	end.weights.z = 0.0f;
-	
+
 	end.indices.x = start.indices.y;
 	end.indices.y = start.indices.x;
-	end.indices.z = next->second;
-
-	//  TODO: compute rotation that takes starting triangle's normal to ending triangle's normal:
-	//  hint: look up 'glm::rotation' in the glm/gtx/quaternion.hpp header
-	//rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f); //identity quat (wxyz init order)
-	auto u1 = vertices[start.indices.y] - vertices[start.indices.x];
-	auto v1 = vertices[start.indices.z] - vertices[start.indices.x];
-	
-	auto u2 = vertices[end.indices.y] - vertices[end.indices.x];
-	auto v2 = vertices[end.indices.z] - vertices[end.indices.x];
-	
-	auto n1 = cross(u1, v1);
-	auto n2 = cross(u2, v2);
-	
-	rotation = glm::rotation(glm::normalize(n1), glm::normalize(n2));
+	end.indices.z = triangles[other / 3][(other % 3 + 2) % 3];
+
+	//compute rotation that takes starting triangle's normal to ending triangle's normal:
+	rotation = glm::rotation(triangle_data[corner / 3].normal, triangle_data[other / 3].normal);
+
 	//return 'true' if there was another triangle, 'false' otherwise:
 	return true;
 }
 
+TriangleWalkPoint WalkMesh::to_triangle_walk_point(WalkPoint const &wp) const {
+	uint32_t corner = find_corner(wp.indices.x, wp.indices.y);
+	assert(corner != -1U && "walkpoint should be on a walkmesh triangle");
 
-WalkMeshes::WalkMeshes(std::string const &filename) {
-	std::ifstream file(filename, std::ios::binary);
+	//un-rotate weights into triangle order:
+	uint32_t r = corner % 3;
+	glm::vec3 weights;
+	weights[r] = wp.weights.x;
+	weights[(r+1)%3] = wp.weights.y;
+	weights[(r+2)%3] = wp.weights.z;
+	//(keep points on the triangle's third edge exactly on it)
+	if (weights.z == 0.0f) weights.y = 1.0f - weights.x;
+	return TriangleWalkPoint(corner / 3, glm::vec2(weights));
+}
+
+void WalkMesh::walk_in_triangle(TriangleWalkPoint const &start, glm::vec3 const &step, TriangleWalkPoint *end_, float *time_, uint32_t *edge_) const {
+	assert(end_);
+	auto &end = *end_;
+	assert(time_);
+	auto &time = *time_;
+	assert(edge_);
+	auto &edge = *edge_;
+
+	TriangleData const &td = triangle_data[start.triangle];
+
+	//barycentric velocity, and time at which each weight would reach zero:
+	glm::vec3 weights = start.barycentric();
+	glm::vec3 bv = glm::vec3(
+		glm::dot(step, td.gradient[0]),
+		glm::dot(step, td.gradient[1]),
+		glm::dot(step, td.gradient[2])
+	);
+	glm::vec3 t = -weights / bv;
+
+	float lowest = 1.0f;
+	int cased = -1;
+	for (int i = 0; i < 3; ++i) {
+		if (t[i] < lowest && t[i] > 0.0f) {
+			cased = i;
+			lowest = t[i];
+		}
+	}
+
+	time = lowest;
+	weights += bv * lowest;
+
+	end.triangle = start.triangle;
+	if (cased == -1) {
+		//whole step stays within the triangle:
+		end.weights = glm::vec2(weights);
+		edge = -1U;
+	} else {
+		//reached the edge opposite vertex 'cased', which starts at the next vertex:
+		weights[cased] = 0.0f;
+		end.weights = glm::vec2(weights);
+		if (cased == 2) end.weights.y = 1.0f - end.weights.x;
+		edge = 3 * start.triangle + (cased + 1) % 3;
+	}
+}
+
+bool WalkMesh::cross_edge(TriangleWalkPoint const &start, uint32_t edge, TriangleWalkPoint *end_, glm::quat *rotation_) const {
+	assert(edge / 3 == start.triangle && "edge should be on the walkpoint's triangle");
+	assert(end_);
+	auto &end = *end_;
+	assert(rotation_);
+	auto &rotation = *rotation_;
+
+	uint32_t other = twins[edge];
+	if (other == -1U) {
+		return false;
+	}
+
+	//the other triangle's half-edge runs the opposite way, so its first vertex gets the weight of this edge's second vertex:
+	glm::vec3 weights = start.barycentric();
+	uint32_t i = edge % 3;
+	uint32_t j = other % 3;
+	glm::vec3 other_weights = glm::vec3(0.0f);
+	other_weights[j] = weights[(i+1)%3];
+	other_weights[(j+1)%3] = weights[i];
+
+	end.triangle = other / 3;
+	end.weights = glm::vec2(other_weights);
+	if (j == 0) end.weights.y = 1.0f - end.weights.x;
+
+	rotation = glm::rotation(triangle_data[start.triangle].normal, triangle_data[other / 3].normal);
+	return true;
+}
+
+glm::vec3 WalkMesh::slide_along_wall(uint32_t edge, glm::vec3 const &step) const {
+	//in-plane direction away from the edge, i.e., the inward direction opposite the vertex not on the edge:
+	glm::vec3 const &in = triangle_data[edge / 3].inward[(edge % 3 + 2) % 3];
+
+	//check how much step is pointing out of the triangle:
+	float d = glm::dot(step, in);
+	if (d < 0.0f) {
+		//bounce off of the wall:
+		return step + (-1.25f * d) * in;
+	} else {
+		//if it's just pointing along the edge, bend slightly away from wall:
+		return step + 0.01f * d * in;
+	}
+}
+
+glm::vec3 WalkMesh::slide_along_wall(WalkPoint const &at, glm::vec3 const &step) const {
+	uint32_t corner = find_corner(at.indices.x, at.indices.y);
+	assert(corner != -1U && "walkpoint should be on a walkmesh triangle");
+	return slide_along_wall(corner, step);
+}
+
+void WalkMesh::update_twins(uint32_t a, uint32_t b) {
+	//half-edge c is linked to its twin o unless the edge was disabled (from either side) or o's triangle is disabled:
+	// (c's own triangle may be disabled -- walkpoints left on a disabled triangle can still walk off)
+	auto update = [this](uint32_t from, uint32_t to) {
+		for (uint32_t i = half_edges_begin[from]; i < half_edges_begin[from+1]; ++i) {
+			if (half_edges[i].to != to) continue;
+			uint32_t c = half_edges[i].corner;
+			uint32_t o = find_corner(to, from);
+			if (o != -1U && (edge_disabled[c] || edge_disabled[o] || triangle_disabled[o / 3])) o = -1U;
+			twins[c] = o;
+		}
+	};
+	update(a, b);
+	update(b, a);
+}
+
+void WalkMesh::set_edge_enabled(uint32_t a, uint32_t b, bool enabled) {
+	assert((find_corner(a, b) != -1U || find_corner(b, a) != -1U) && "edge should be on the walkmesh");
+	for (uint32_t i = half_edges_begin[a]; i < half_edges_begin[a+1]; ++i) {
+		if (half_edges[i].to == b) edge_disabled[half_edges[i].corner] = !enabled;
+	}
+	for (uint32_t i = half_edges_begin[b]; i < half_edges_begin[b+1]; ++i) {
+		if (half_edges[i].to == a) edge_disabled[half_edges[i].corner] = !enabled;
+	}
+	update_twins(a, b);
+}
+
+void WalkMesh::set_triangle_enabled(uint32_t triangle, bool enabled) {
+	assert(triangle < triangles.size());
+	triangle_disabled[triangle] = !enabled;
+	glm::uvec3 const &tri = triangles[triangle];
+	update_twins(tri.x, tri.y);
+	update_twins(tri.y, tri.z);
+	update_twins(tri.z, tri.x);
+}
+
+//-----------------------------------------
+
+uint32_t WalkAgents::add(TriangleWalkPoint const &at) {
+	uint32_t i = size();
+	triangle.emplace_back(at.triangle);
+	weight_x.emplace_back(at.weights.x); weight_y.emplace_back(at.weights.y);
+	step_x.emplace_back(0.0f); step_y.emplace_back(0.0f); step_z.emplace_back(0.0f);
+	return i;
+}
+
+void WalkAgents::remove(uint32_t i) {
+	assert(i < size());
+	triangle[i] = triangle.back();
+	triangle.pop_back();
+	for (auto v : {&weight_x, &weight_y, &step_x, &step_y, &step_z}) {
+		(*v)[i] = v->back();
+		v->pop_back();
+	}
+}
+
+//walk agents [begin,end) -- the body of walk_agents, run on one thread (using that thread's scratch space):
+static void walk_agents_range(WalkMesh const &wm, WalkAgents &agents, WalkAgents::Scratch &scratch, uint32_t begin, uint32_t end) {
+	//move agent i within its triangle, returning the edge it stopped at (the index of the vertex opposite it, or 3 for none):
+	// This has no data-dependent branches, so loops over it can be vectorized over the SoA arrays.
+	// (agents with zero step end up with time 1.0 and unchanged weights)
+	auto walk_in_triangle = [&wm, &agents](uint32_t i) -> uint8_t {
+		WalkMesh::TriangleData const &td = wm.triangle_data[agents.triangle[i]];
+
+		glm::vec3 weights = agents.get(i).barycentric();
+		glm::vec3 step(agents.step_x[i], agents.step_y[i], agents.step_z[i]);
+
+		glm::vec3 bv = glm::vec3(
+			glm::dot(step, td.gradient[0]),
+			glm::dot(step, td.gradient[1]),
+			glm::dot(step, td.gradient[2])
+		);
+
+		//time at which each weight reaches zero:
+		glm::vec3 t = -weights / bv;
+
+		float time = 1.0f;
+		uint8_t edge = 3;
+		edge = (t.x > 0.0f && t.x < time ? 0 : edge); time = (edge == 0 ? t.x : time);
+		edge = (t.y > 0.0f && t.y < time ? 1 : edge); time = (edge == 1 ? t.y : time);
+		edge = (t.z > 0.0f && t.z < time ? 2 : edge); time = (edge == 2 ? t.z : time);
+
+		//(a weight that reached zero is set to exactly zero, so the agent is exactly on the edge)
+		weights += bv * time;
+		agents.weight_x[i] = (edge == 0 ? 0.0f : weights.x);
+		agents.weight_y[i] = (edge == 1 ? 0.0f : (edge == 2 ? 1.0f - agents.weight_x[i] : weights.y));
+
+		float remain = 1.0f - time;
+		agents.step_x[i] *= remain; agents.step_y[i] *= remain; agents.step_z[i] *= remain;
+
+		return edge;
+	};
+
+	//move agent i (which is on the edge opposite vertex 'edge') over that edge, or bounce / slide along it if it is a wall:
+	auto cross_edge = [&wm, &agents](uint32_t i, uint8_t edge) {
+		TriangleWalkPoint at = agents.get(i);
+		glm::vec3 step(agents.step_x[i], agents.step_y[i], agents.step_z[i]);
+
+		uint32_t corner = 3 * at.triangle + (edge + 1) % 3;
+		TriangleWalkPoint end;
+		glm::quat rotation;
+		if (wm.cross_edge(at, corner, &end, &rotation)) {
+			//stepped to a new triangle; rotate step to follow surface:
+			at = end;
+			step = rotation * step;
+		} else {
+			//ran into a wall, bounce / slide along it:
+			step = wm.slide_along_wall(corner, step);
+		}
+
+		agents.set(i, at);
+		agents.set_step(i, step);
+	};
+
+	//first iteration runs over the whole (contiguous) range:
+	std::vector< uint8_t > &edges = scratch.edges;
+	edges.resize(end - begin);
+	for (uint32_t i = begin; i < end; ++i) {
+		edges[i - begin] = walk_in_triangle(i);
+	}
+	std::vector< uint32_t > &active = scratch.active;
+	active.clear();
+	for (uint32_t i = begin; i < end; ++i) {
+		if (edges[i - begin] != 3) {
+			cross_edge(i, edges[i - begin]);
+			active.emplace_back(i);
+		}
+	}
+
+	//later iterations only revisit agents that still have some step remaining:
+	for (uint32_t iter = 1; iter < 10 && !active.empty(); ++iter) {
+		uint32_t still_active = 0;
+		for (uint32_t i : active) {
+			uint8_t edge = walk_in_triangle(i);
+			if (edge != 3) {
+				cross_edge(i, edge);
+				active[still_active++] = i;
+			}
+		}
+		active.resize(still_active);
+	}
+}
+
+void WalkMesh::walk_agents(WalkAgents &agents, uint32_t threads) const {
+	//don't bother spinning up threads for small batches:
+	constexpr uint32_t MinAgentsPerThread = 256;
+	threads = std::max(1U, std::min(threads, agents.size() / MinAgentsPerThread));
+
+	//agents are independent, so each thread walks a contiguous slice of them:
+	if (agents.scratch.size() < threads) agents.scratch.resize(threads);
+	parallel_ranges(threads, agents.size(), [this, &agents](uint32_t thread, uint32_t begin, uint32_t end) {
+		walk_agents_range(*this, agents, agents.scratch[thread], begin, end);
+	});
+}
+
+
+//-----------------------------------------
+
+bool WalkMesh::raycast(WalkPoint const &start, glm::vec3 const &step, WalkPoint *end_, float *time_) const {
+	assert(end_);
+	auto &end = *end_;
+	assert(time_);
+	auto &time = *time_;
+
+	WalkPoint at = start;
+	glm::vec3 remain = step;
+	time = 0.0f;
+
+	//each iteration enters a new triangle, so (absent numerical trouble) the trace can't take more iterations than there are triangles:
+	for (uint32_t iter = 0; iter <= triangles.size(); ++iter) {
+		WalkPoint next;
+		float t;
+		walk_in_triangle(at, remain, &next, &t);
+		at = next;
+		time = 1.0f - (1.0f - time) * (1.0f - t);
+		if (t == 1.0f) {
+			end = at;
+			time = 1.0f;
+			return true;
+		}
+		remain *= (1.0f - t);
+
+		glm::quat rotation;
+		if (!cross_edge(at, &next, &rotation)) {
+			//hit a boundary edge:
+			end = at;
+			return false;
+		}
+		at = next;
+		remain = rotation * remain;
+	}
+
+	//out of iterations; report where the trace stopped:
+	end = at;
+	return false;
+}
+
+bool WalkMesh::line_of_sight(WalkPoint const &from, WalkPoint const &to) const {
+	//trace the line from 'from' to 'to' as seen from above (i.e., in the xy plane), lifting the remaining part onto each triangle in turn:
+	// (a plain raycast() would drift away from 'to' on sloped walkmeshes, since steps are projected onto each triangle's plane)
+	glm::vec3 target = to_world_point(to);
+	float tolerance = 1e-3f * (1.0f + glm::length(target - to_world_point(from)));
+
+	WalkPoint at = from;
+	for (uint32_t iter = 0; iter <= triangles.size(); ++iter) {
+		glm::vec3 pos = to_world_point(at);
+		glm::vec3 const &normal = triangle_data[find_triangle(at)].normal;
+		if (std::abs(normal.z) < 1e-6f) return false; //vertical triangle; not crossable from above
+
+		float dx = target.x - pos.x;
+		float dy = target.y - pos.y;
+		glm::vec3 step(dx, dy, -(normal.x * dx + normal.y * dy) / normal.z);
+
+		WalkPoint next;
+		float time;
+		walk_in_triangle(at, step, &next, &time);
+		at = next;
+		if (time == 1.0f) {
+			//reached target's xy position; make sure it's on the same layer as target:
+			return glm::length(to_world_point(at) - target) < tolerance;
+		}
+
+		glm::quat rotation;
+		if (!cross_edge(at, &next, &rotation)) return false;
+		at = next;
+	}
+	return false;
+}
 
-	std::vector< glm::vec3 > vertices;
-	read_chunk(file, "p...", &vertices);
+bool WalkMesh::intersect_ray(glm::vec3 const &origin, glm::vec3 const &direction, float max_distance, WalkPoint *hit_, float *distance_) const {
+	assert(hit_);
+	auto &hit = *hit_;
+	assert(distance_);
+	auto &distance = *distance_;
 
-	std::vector< glm::vec3 > normals;
-	read_chunk(file, "n...", &normals);
+	if (bvh_nodes.empty()) return false;
 
-	std::vector< glm::uvec3 > triangles;
-	read_chunk(file, "tri0", &triangles);
+	glm::vec3 inv_direction = 1.0f / direction;
 
-	std::vector< char > names;
-	read_chunk(file, "str0", &names);
+	//distance along ray to enter a bvh node's box (or infinity if the ray misses it):
+	auto box_enter = [&](BVHNode const &node, float limit) {
+		float enter = 0.0f;
+		float exit = limit;
+		for (uint32_t i = 0; i < 3; ++i) {
+			//ray parallel to this pair of planes is between them everywhere or nowhere (and (min - origin) * inv_direction could be 0 * inf = NaN):
+			if (direction[i] == 0.0f) {
+				if (origin[i] < node.min[i] || origin[i] > node.max[i]) return std::numeric_limits< float >::infinity();
+				continue;
+			}
+			float t0 = (node.min[i] - origin[i]) * inv_direction[i];
+			float t1 = (node.max[i] - origin[i]) * inv_direction[i];
+			enter = std::max(enter, std::min(t0, t1));
+			exit = std::min(exit, std::max(t0, t1));
+		}
+		return (enter <= exit ? enter : std::numeric_limits< float >::infinity());
+	};
+
+	bool found = false;
+	distance = max_distance;
+
+	constexpr uint32_t StackSize = 64;
+	uint32_t stack[StackSize];
+	uint32_t stack_size = 0;
+	if (box_enter(bvh_nodes[0], distance) != std::numeric_limits< float >::infinity()) {
+		stack[stack_size++] = 0;
+	}
+	while (stack_size > 0) {
+		BVHNode const &node = bvh_nodes[stack[--stack_size]];
+		if (box_enter(node, distance) == std::numeric_limits< float >::infinity()) continue;
+
+		if (node.count != 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				if (triangle_disabled[bvh_triangles[i]]) continue;
+				glm::uvec3 const &tri = triangles[bvh_triangles[i]];
+				glm::vec3 const &a = vertices[tri.x];
+				glm::vec3 const &b = vertices[tri.y];
+				glm::vec3 const &c = vertices[tri.z];
+
+				//Moller-Trumbore ray/triangle intersection:
+				glm::vec3 u = b - a;
+				glm::vec3 v = c - a;
+				glm::vec3 p = glm::cross(direction, v);
+				float det = glm::dot(u, p);
+				if (det == 0.0f) continue; //ray parallel to triangle
+				float inv_det = 1.0f / det;
+				glm::vec3 d = origin - a;
+				float wy = glm::dot(d, p) * inv_det;
+				if (wy < 0.0f || wy > 1.0f) continue;
+				glm::vec3 q = glm::cross(d, u);
+				float wz = glm::dot(direction, q) * inv_det;
+				if (wz < 0.0f || wy + wz > 1.0f) continue;
+				float t = glm::dot(v, q) * inv_det;
+				if (t < 0.0f || t > distance) continue;
+
+				found = true;
+				distance = t;
+				hit.indices = tri;
+				hit.weights = glm::vec3(1.0f - wy - wz, wy, wz);
+			}
+		} else {
+			assert(stack_size + 2 <= StackSize);
+			//push farther child first so nearer child is visited first:
+			float ta = box_enter(bvh_nodes[node.first], distance);
+			float tb = box_enter(bvh_nodes[node.first + 1], distance);
+			if (ta < tb) {
+				if (tb != std::numeric_limits< float >::infinity()) stack[stack_size++] = node.first + 1;
+				stack[stack_size++] = node.first;
+			} else {
+				if (ta != std::numeric_limits< float >::infinity()) stack[stack_size++] = node.first;
+				if (tb != std::numeric_limits< float >::infinity()) stack[stack_size++] = node.first + 1;
+			}
+		}
+	}
+
+	return found;
+}
+
+//-----------------------------------------
+
+//call f(hit) for each triangle of wm above or below xy:
+// NOTE: points on edges shared by several triangles are reported once per triangle
+template< typename F >
+static void for_each_height(WalkMesh const &wm, glm::vec2 const &xy, F const &f) {
+	if (wm.grid_cells_begin.empty()) return;
+	glm::vec2 at = (xy - wm.grid_min) / wm.grid_cell_size;
+	if (!(at.x >= 0.0f && at.y >= 0.0f && at.x < float(wm.grid_size.x) && at.y < float(wm.grid_size.y))) return;
+	uint32_t cell = uint32_t(at.y) * wm.grid_size.x + uint32_t(at.x);
+
+	//(small tolerance so points exactly on an edge aren't missed by both triangles due to rounding)
+	constexpr float Epsilon = 1e-6f;
+	for (uint32_t i = wm.grid_cells_begin[cell]; i < wm.grid_cells_begin[cell+1]; ++i) {
+		if (wm.triangle_disabled[wm.grid_triangles[i]]) continue;
+		glm::uvec3 const &tri = wm.triangles[wm.grid_triangles[i]];
+		glm::vec3 const &a = wm.vertices[tri.x];
+		glm::vec3 const &b = wm.vertices[tri.y];
+		glm::vec3 const &c = wm.vertices[tri.z];
+
+		//barycentric weights of xy in the xy projection of the triangle:
+		auto cross2 = [](glm::vec2 const &u, glm::vec2 const &v) { return u.x * v.y - u.y * v.x; };
+		float area = cross2(glm::vec2(b - a), glm::vec2(c - a));
+		glm::vec3 weights = glm::vec3(
+			cross2(glm::vec2(b) - xy, glm::vec2(c) - xy),
+			cross2(glm::vec2(c) - xy, glm::vec2(a) - xy),
+			cross2(glm::vec2(a) - xy, glm::vec2(b) - xy)
+		) / area;
+		if (weights.x < -Epsilon || weights.y < -Epsilon || weights.z < -Epsilon) continue;
+		weights = glm::max(weights, glm::vec3(0.0f));
+		weights /= weights.x + weights.y + weights.z;
+
+		WalkMesh::HeightHit hit;
+		hit.at = WalkPoint(tri, weights);
+		hit.height = weights.x * a.z + weights.y * b.z + weights.z * c.z;
+		f(hit);
+	}
+}
+
+void WalkMesh::heights_at(glm::vec2 const &xy, std::vector< HeightHit > *hits_) const {
+	assert(hits_);
+	auto &hits = *hits_;
+
+	hits.clear();
+	for_each_height(*this, xy, [&hits](HeightHit const &hit) {
+		hits.emplace_back(hit);
+	});
+
+	//sort by height, and drop repeats from points on edges shared by triangles of the same surface:
+	std::sort(hits.begin(), hits.end(), [](HeightHit const &a, HeightHit const &b) {
+		return a.height < b.height;
+	});
+	constexpr float SameSurface = 1e-4f;
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < hits.size(); ++i) {
+		if (kept != 0 && hits[i].height - hits[kept-1].height <= SameSurface) continue;
+		hits[kept++] = hits[i];
+	}
+	hits.resize(kept);
+}
+
+bool WalkMesh::height_at(glm::vec2 const &xy, float reference_height, WalkPoint *at_, float *height_) const {
+	assert(at_);
+	auto &at = *at_;
+	assert(height_);
+	auto &height = *height_;
+
+	//best surface so far is the highest at or below reference_height, then the lowest above it:
+	bool found = false;
+	bool found_below = false;
+	for_each_height(*this, xy, [&](HeightHit const &hit) {
+		bool below = (hit.height <= reference_height);
+		if (!found
+		 || (below && !found_below)
+		 || (below && hit.height > height)
+		 || (!below && !found_below && hit.height < height)) {
+			found = true;
+			found_below = below;
+			at = hit.at;
+			height = hit.height;
+		}
+	});
+	return found;
+}
+
+//-----------------------------------------
+
+std::vector< uint32_t > const *WalkPathCache::find(uint32_t start_triangle, uint32_t goal_triangle) {
+	auto f = lookup.find((uint64_t(start_triangle) << 32) | goal_triangle);
+	if (f == lookup.end()) return nullptr;
+	//move to front of recently-used list:
+	entries.splice(entries.begin(), entries, f->second);
+	return &f->second->corridor;
+}
+
+void WalkPathCache::insert(uint32_t start_triangle, uint32_t goal_triangle, std::vector< uint32_t > const &corridor) {
+	uint64_t key = (uint64_t(start_triangle) << 32) | goal_triangle;
+	auto f = lookup.find(key);
+	if (f != lookup.end()) {
+		f->second->corridor = corridor;
+		entries.splice(entries.begin(), entries, f->second);
+		return;
+	}
+	entries.emplace_front();
+	entries.front().key = key;
+	entries.front().corridor = corridor;
+	lookup.emplace(key, entries.begin());
+	while (entries.size() > capacity) {
+		lookup.erase(entries.back().key);
+		entries.pop_back();
+	}
+}
+
+void WalkPathCache::clear() {
+	entries.clear();
+	lookup.clear();
+}
+
+bool WalkMesh::find_corridor(uint32_t start_triangle, uint32_t goal_triangle, std::vector< uint32_t > *corridor_) const {
+	assert(corridor_);
+	auto &corridor = *corridor_;
+	corridor.clear();
+	assert(start_triangle < triangles.size() && goal_triangle < triangles.size());
+
+	auto centroid = [this](uint32_t t) {
+		return (vertices[triangles[t].x] + vertices[triangles[t].y] + vertices[triangles[t].z]) / 3.0f;
+	};
+	glm::vec3 goal_centroid = centroid(goal_triangle);
+
+	//A* over triangles, with cost measured between triangle centroids:
+	// (straight-line distance to the goal centroid is an admissible heuristic for this cost)
+	std::vector< float > cost(triangles.size(), std::numeric_limits< float >::infinity());
+	std::vector< uint32_t > from(triangles.size(), -1U);
+
+	typedef std::pair< float, uint32_t > Open; //(cost + heuristic, triangle)
+	std::priority_queue< Open, std::vector< Open >, std::greater< Open > > open;
+
+	cost[start_triangle] = 0.0f;
+	open.emplace(glm::length(goal_centroid - centroid(start_triangle)), start_triangle);
+	while (!open.empty()) {
+		uint32_t t = open.top().second;
+		float estimate = open.top().first;
+		open.pop();
+		if (t == goal_triangle) break;
+		glm::vec3 at = centroid(t);
+		//skip stale queue entries:
+		if (estimate > cost[t] + glm::length(goal_centroid - at)) continue;
+
+		for (uint32_t i = 0; i < 3; ++i) {
+			uint32_t twin = twin_corner(3*t+i);
+			if (twin == -1U) continue;
+			uint32_t n = twin / 3;
+			glm::vec3 next = centroid(n);
+			float next_cost = cost[t] + glm::length(next - at);
+			if (next_cost < cost[n]) {
+				cost[n] = next_cost;
+				from[n] = t;
+				open.emplace(next_cost + glm::length(goal_centroid - next), n);
+			}
+		}
+	}
+
+	if (cost[goal_triangle] == std::numeric_limits< float >::infinity()) return false;
+
+	for (uint32_t t = goal_triangle; t != -1U; t = from[t]) {
+		corridor.emplace_back(t);
+	}
+	std::reverse(corridor.begin(), corridor.end());
+	assert(corridor[0] == start_triangle);
+	return true;
+}
+
+bool WalkMesh::find_path(WalkPoint const &start, WalkPoint const &goal, std::vector< glm::vec3 > *waypoints_, WalkPathCache *cache) const {
+	assert(waypoints_);
+	auto &waypoints = *waypoints_;
+	waypoints.clear();
+
+	uint32_t start_triangle = find_triangle(start);
+	uint32_t goal_triangle = find_triangle(goal);
+
+	//get corridor (from cache if possible):
+	std::vector< uint32_t > const *corridor = (cache ? cache->find(start_triangle, goal_triangle) : nullptr);
+	std::vector< uint32_t > found;
+	if (!corridor) {
+		if (!find_corridor(start_triangle, goal_triangle, &found)) return false;
+		if (cache) cache->insert(start_triangle, goal_triangle, found);
+		corridor = &found;
+	}
+
+	glm::vec3 start_point = to_world_point(start);
+	glm::vec3 goal_point = to_world_point(goal);
+
+	//portals between consecutive corridor triangles, as (left, right) when walking along the corridor:
+	// (the final portal is the goal point itself)
+	std::vector< std::pair< glm::vec3, glm::vec3 > > portals;
+	portals.reserve(corridor->size());
+	for (uint32_t i = 0; i + 1 < corridor->size(); ++i) {
+		uint32_t t = (*corridor)[i];
+		uint32_t n = (*corridor)[i+1];
+		uint32_t j = 0;
+		while (j < 3 && (twin_corner(3*t+j) == -1U || twin_corner(3*t+j) / 3 != n)) ++j;
+		assert(j < 3 && "corridor triangles should be adjacent");
+		//triangles are CCW, so walking out over edge a->b, b is on the left and a is on the right:
+		portals.emplace_back(vertices[triangles[t][(j+1)%3]], vertices[triangles[t][j]]);
+	}
+	portals.emplace_back(goal_point, goal_point);
+
+	//signed area of (a,b,c) in the xy plane -- positive if c is to the left of a->b:
+	auto area2 = [](glm::vec3 const &a, glm::vec3 const &b, glm::vec3 const &c) {
+		return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+	};
+
+	//"simple stupid funnel algorithm":
+	waypoints.emplace_back(start_point);
+	glm::vec3 apex = start_point;
+	glm::vec3 left = start_point;
+	glm::vec3 right = start_point;
+	uint32_t left_index = 0;
+	uint32_t right_index = 0;
+	for (uint32_t i = 0; i < portals.size(); ++i) {
+		glm::vec3 const &new_left = portals[i].first;
+		glm::vec3 const &new_right = portals[i].second;
+
+		//try to narrow the right side of the funnel:
+		if (area2(apex, right, new_right) >= 0.0f) {
+			if (apex == right || area2(apex, left, new_right) < 0.0f) {
+				right = new_right;
+				right_index = i;
+			} else {
+				//right crossed over left, so left becomes a corner of the path:
+				apex = left;
+				waypoints.emplace_back(apex);
+				right = apex;
+				right_index = left_index;
+				i = left_index;
+				continue;
+			}
+		}
+
+		//try to narrow the left side of the funnel:
+		if (area2(apex, left, new_left) <= 0.0f) {
+			if (apex == left || area2(apex, right, new_left) > 0.0f) {
+				left = new_left;
+				left_index = i;
+			} else {
+				//left crossed over right, so right becomes a corner of the path:
+				apex = right;
+				waypoints.emplace_back(apex);
+				left = apex;
+				left_index = right_index;
+				i = right_index;
+				continue;
+			}
+		}
+	}
+	if (waypoints.back() != goal_point) waypoints.emplace_back(goal_point);
+
+	return true;
+}
+
+//-----------------------------------------
+
+//octahedral normal encoding: project onto the octahedron |x|+|y|+|z| = 1, then fold the lower half over the upper half:
+static glm::vec2 sign_not_zero(glm::vec2 const &v) {
+	return glm::vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+static glm::vec2 octahedral_encode(glm::vec3 const &n) {
+	glm::vec2 p = glm::vec2(n.x, n.y) / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+	if (n.z < 0.0f) {
+		p = (1.0f - glm::abs(glm::vec2(p.y, p.x))) * sign_not_zero(p);
+	}
+	return p;
+}
+
+static glm::vec3 octahedral_decode(glm::vec2 const &p) {
+	glm::vec3 n = glm::vec3(p.x, p.y, 1.0f - std::abs(p.x) - std::abs(p.y));
+	if (n.z < 0.0f) {
+		glm::vec2 xy = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * sign_not_zero(glm::vec2(n.x, n.y));
+		n.x = xy.x;
+		n.y = xy.y;
+	}
+	return glm::normalize(n);
+}
+
+CompactWalkMesh::CompactWalkMesh(WalkMesh const &walkmesh) {
+	uint32_t triangle_count = uint32_t(walkmesh.triangles.size());
+
+	//only vertices that triangles use matter (the source may have others, which shouldn't affect bounds or index width):
+	std::vector< uint8_t > used(walkmesh.vertices.size(), 0);
+	uint32_t vertex_end = 0;
+	vertex_base = -1U;
+	for (auto const &tri : walkmesh.triangles) {
+		for (uint32_t i = 0; i < 3; ++i) {
+			used[tri[i]] = 1;
+			vertex_base = std::min(vertex_base, tri[i]);
+			vertex_end = std::max(vertex_end, tri[i] + 1);
+		}
+	}
+	if (vertex_end == 0) vertex_base = 0;
+	uint32_t vertex_count = vertex_end - vertex_base; //(per-vertex arrays cover vertex_base .. vertex_end-1)
+
+	//quantize positions within the bounding box of the used vertices:
+	glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+	glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+	for (uint32_t v = vertex_base; v < vertex_end; ++v) {
+		if (!used[v]) continue;
+		min = glm::min(min, walkmesh.vertices[v]);
+		max = glm::max(max, walkmesh.vertices[v]);
+	}
+	if (vertex_count == 0) min = max = glm::vec3(0.0f);
+	position_min = min;
+	position_scale = (max - min) / 65535.0f;
+
+	//(unused vertices in the range are clamped into the box; nothing refers to them)
+	positions.reserve(3 * vertex_count);
+	for (uint32_t v = vertex_base; v < vertex_end; ++v) {
+		for (uint32_t i = 0; i < 3; ++i) {
+			float q = (position_scale[i] > 0.0f ? (walkmesh.vertices[v][i] - min[i]) / position_scale[i] : 0.0f);
+			positions.emplace_back(uint16_t(std::min(std::max(std::round(q), 0.0f), 65535.0f)));
+		}
+	}
+
+	normals.reserve(2 * vertex_count);
+	for (uint32_t v = vertex_base; v < vertex_end; ++v) {
+		glm::vec2 p = octahedral_encode(walkmesh.normals[v]);
+		normals.emplace_back(int16_t(std::round(glm::clamp(p.x, -1.0f, 1.0f) * 32767.0f)));
+		normals.emplace_back(int16_t(std::round(glm::clamp(p.y, -1.0f, 1.0f) * 32767.0f)));
+	}
+
+	//store triangles in bvh order, so that bvh leaves can refer to them directly:
+	std::vector< uint32_t > order(walkmesh.bvh_triangles.begin(), walkmesh.bvh_triangles.end());
+	if (vertex_count <= 65536) {
+		indices16.reserve(3 * triangle_count);
+		for (uint32_t t : order) {
+			for (uint32_t i = 0; i < 3; ++i) indices16.emplace_back(uint16_t(walkmesh.triangles[t][i] - vertex_base));
+		}
+	} else {
+		indices32.reserve(3 * triangle_count);
+		for (uint32_t t : order) {
+			for (uint32_t i = 0; i < 3; ++i) indices32.emplace_back(walkmesh.triangles[t][i] - vertex_base);
+		}
+	}
+
+	//group corners by starting vertex (counting sort, as in the WalkMesh constructor):
+	corners_begin.assign(vertex_count + 1, 0);
+	for (uint32_t c = 0; c < 3 * triangle_count; ++c) {
+		corners_begin[index(c) - vertex_base + 1] += 1;
+	}
+	for (uint32_t v = 0; v < vertex_count; ++v) {
+		corners_begin[v + 1] += corners_begin[v];
+	}
+	corners.resize(3 * triangle_count);
+	{
+		std::vector< uint32_t > next(corners_begin.begin(), corners_begin.end() - 1);
+		for (uint32_t c = 0; c < 3 * triangle_count; ++c) {
+			corners[next[index(c) - vertex_base]++] = c;
+		}
+	}
+
+	//copy bvh, padding bounds so they still contain the (quantized) triangles:
+	bvh_nodes.assign(walkmesh.bvh_nodes.begin(), walkmesh.bvh_nodes.end());
+	for (auto &node : bvh_nodes) {
+		node.min -= position_scale;
+		node.max += position_scale;
+	}
+
+	//measure accuracy (of used vertices):
+	for (uint32_t v = vertex_base; v < vertex_end; ++v) {
+		if (!used[v]) continue;
+		accuracy.max_position_error = std::max(accuracy.max_position_error, glm::length(position(v) - walkmesh.vertices[v]));
+		float d = glm::dot(normal(v), glm::normalize(walkmesh.normals[v]));
+		accuracy.max_normal_error = std::max(accuracy.max_normal_error, std::acos(glm::clamp(d, -1.0f, 1.0f)));
+	}
+}
+
+glm::vec3 CompactWalkMesh::normal(uint32_t v) const {
+	return octahedral_decode(glm::vec2(normals[2*(v-vertex_base)+0], normals[2*(v-vertex_base)+1]) / 32767.0f);
+}
+
+WalkPoint CompactWalkMesh::nearest_walk_point(glm::vec3 const &world_point) const {
+	assert(!corners.empty() && "Cannot start on an empty walkmesh");
+
+	WalkPoint closest;
+	float closest_dis2 = std::numeric_limits< float >::infinity();
+
+	//same traversal as WalkMesh::nearest_walk_point:
+	constexpr uint32_t StackSize = 64;
+	uint32_t stack[StackSize];
+	uint32_t stack_size = 0;
+	stack[stack_size++] = 0;
+	while (stack_size > 0) {
+		WalkMesh::BVHNode const &node = bvh_nodes[stack[--stack_size]];
+		if (box_dis2(node.min, node.max, world_point) > closest_dis2) continue;
+
+		if (node.count != 0) {
+			for (uint32_t t = node.first; t < node.first + node.count; ++t) {
+				glm::uvec3 tri(index(3*t+0), index(3*t+1), index(3*t+2));
+				WalkPoint wp;
+				float dis2 = closest_on_triangle(position(tri.x), position(tri.y), position(tri.z), tri, world_point, &wp);
+				if (dis2 < closest_dis2) {
+					closest_dis2 = dis2;
+					closest = wp;
+				}
+			}
+		} else {
+			assert(stack_size + 2 <= StackSize);
+			WalkMesh::BVHNode const &a = bvh_nodes[node.first];
+			WalkMesh::BVHNode const &b = bvh_nodes[node.first + 1];
+			if (box_dis2(a.min, a.max, world_point) < box_dis2(b.min, b.max, world_point)) {
+				stack[stack_size++] = node.first + 1;
+				stack[stack_size++] = node.first;
+			} else {
+				stack[stack_size++] = node.first;
+				stack[stack_size++] = node.first + 1;
+			}
+		}
+	}
+
+	return closest;
+}
+
+void CompactWalkMesh::walk_in_triangle(WalkPoint const &start, glm::vec3 const &step, WalkPoint *end_, float *time_) const {
+	assert(end_);
+	auto &end = *end_;
+	assert(time_);
+	auto &time = *time_;
+
+	//barycentric weight gradients (as in WalkMesh::TriangleData), computed from the decoded positions:
+	glm::vec3 a = position(start.indices.x);
+	glm::vec3 u = position(start.indices.y) - a;
+	glm::vec3 v = position(start.indices.z) - a;
+	glm::vec3 n = glm::cross(u, v);
+	float inv_n2 = 1.0f / glm::dot(n, n);
+	glm::vec3 g1 = glm::cross(v, n) * inv_n2;
+	glm::vec3 g2 = glm::cross(n, u) * inv_n2;
+
+	//transform 'step' into a barycentric velocity on (a,b,c):
+	float by = glm::dot(step, g1);
+	float bz = glm::dot(step, g2);
+	glm::vec3 bv = glm::vec3(-(by + bz), by, bz);
+
+	//time at which each weight would reach zero:
+	glm::vec3 t = -start.weights / bv;
+
+	float lowest = 1.0f;
+	int cased = -1;
+	for (int i = 0; i < 3; ++i) {
+		if (t[i] < lowest && t[i] > 0.0f) {
+			cased = i;
+			lowest = t[i];
+		}
+	}
+
+	time = lowest;
+	glm::vec3 finals = start.weights + bv * lowest;
+
+	if (cased == -1) {
+		end.indices = start.indices;
+		end.weights = finals;
+	} else if (cased == 0) {
+		end.weights = glm::vec3(finals.y, finals.z, 0.0f);
+		end.indices = glm::uvec3(start.indices.y, start.indices.z, start.indices.x);
+	} else if (cased == 1) {
+		end.weights = glm::vec3(finals.z, finals.x, 0.0f);
+		end.indices = glm::uvec3(start.indices.z, start.indices.x, start.indices.y);
+	} else { //cased == 2
+		end.weights = glm::vec3(finals.x, finals.y, 0.0f);
+		end.indices = start.indices;
+	}
+}
+
+bool CompactWalkMesh::cross_edge(WalkPoint const &start, WalkPoint *end_, glm::quat *rotation_) const {
+	assert(end_);
+	auto &end = *end_;
+	assert(rotation_);
+	auto &rotation = *rotation_;
+
+	uint32_t other = find_corner(start.indices.y, start.indices.x);
+	if (other == -1U) {
+		return false;
+	}
+
+	end.weights = glm::vec3(start.weights.y, start.weights.x, 0.0f);
+	end.indices = glm::uvec3(start.indices.y, start.indices.x, index(other % 3 == 0 ? other + 2 : other - 1));
+
+	//rotation between the triangles' normals (which share the edge a-b):
+	glm::vec3 a = position(start.indices.x);
+	glm::vec3 b = position(start.indices.y);
+	glm::vec3 from = glm::cross(b - a, position(start.indices.z) - a);
+	glm::vec3 to = glm::cross(a - b, position(end.indices.z) - b);
+	rotation = glm::rotation(glm::normalize(from), glm::normalize(to));
+
+	return true;
+}
+
+WalkMeshFile::WalkMeshFile(std::string const &filename) {
+	//map the file and find its chunks in place:
+	file = std::make_shared< MappedFile >(filename);
+	char const *at = file->data;
+	char const *end = file->data + file->size;
+
+	glm::vec3 const *vertex_data; size_t vertex_count;
+	view_chunk(&at, end, "p...", &vertex_data, &vertex_count);
+
+	glm::vec3 const *normal_data; size_t normal_count;
+	view_chunk(&at, end, "n...", &normal_data, &normal_count);
+
+	glm::uvec3 const *triangle_data; size_t triangle_count;
+	view_chunk(&at, end, "tri0", &triangle_data, &triangle_count);
+
+	char const *names; size_t names_count;
+	view_chunk(&at, end, "str0", &names, &names_count);
 
 	struct IndexEntry {
 		uint32_t name_begin, name_end;
@@ -266,56 +1622,112 @@ WalkMeshes::WalkMeshes(std::string const &filename) {
 		uint32_t triangle_begin, triangle_end;
 	};
 
-	std::vector< IndexEntry > index;
-	read_chunk(file, "idxA", &index);
+	//(index follows the arbitrarily-sized string chunk, so may not be aligned -- copy it out)
+	char const *index_data; size_t index_bytes;
+	view_chunk(&at, end, "idxA", &index_data, &index_bytes);
+	if (index_bytes % sizeof(IndexEntry) != 0) {
+		throw std::runtime_error("Size of chunk not divisible by element size");
+	}
+	std::vector< IndexEntry > index(index_bytes / sizeof(IndexEntry));
+	if (!index.empty()) std::memcpy(index.data(), index_data, index_bytes);
 
-	if (file.peek() != EOF) {
+	if (at != end) {
 		std::cerr << "WARNING: trailing data in walkmesh file '" << filename << "'" << std::endl;
 	}
 
 	//-----------------
 
-	if (vertices.size() != normals.size()) {
+	if (vertex_count != normal_count) {
 		throw std::runtime_error("Mis-matched position and normal sizes in '" + filename + "'");
 	}
 
+	vertices = WalkMesh::View< glm::vec3 >(vertex_data, vertex_count);
+	normals = WalkMesh::View< glm::vec3 >(normal_data, normal_count);
+	triangles = WalkMesh::View< glm::uvec3 >(triangle_data, triangle_count);
+
 	for (auto const &e : index) {
-		if (!(e.name_begin <= e.name_end && e.name_end <= names.size())) {
+		if (!(e.name_begin <= e.name_end && e.name_end <= names_count)) {
 			throw std::runtime_error("Invalid name indices in index of '" + filename + "'");
 		}
-		if (!(e.vertex_begin <= e.vertex_end && e.vertex_end <= vertices.size())) {
+		if (!(e.vertex_begin <= e.vertex_end && e.vertex_end <= vertex_count)) {
 			throw std::runtime_error("Invalid vertex indices in index of '" + filename + "'");
 		}
-		if (!(e.triangle_begin <= e.triangle_end && e.triangle_end <= triangles.size())) {
+		if (!(e.triangle_begin <= e.triangle_end && e.triangle_end <= triangle_count)) {
 			throw std::runtime_error("Invalid triangle indices in index of '" + filename + "'");
 		}
 
-		//copy vertices/normals:
-		std::vector< glm::vec3 > wm_vertices(vertices.begin() + e.vertex_begin, vertices.begin() + e.vertex_end);
-		std::vector< glm::vec3 > wm_normals(normals.begin() + e.vertex_begin, normals.begin() + e.vertex_end);
-
-		//remap triangles:
-		std::vector< glm::uvec3 > wm_triangles; wm_triangles.reserve(e.triangle_end - e.triangle_begin);
+		//check triangles:
 		for (uint32_t ti = e.triangle_begin; ti != e.triangle_end; ++ti) {
 			if (!( (e.vertex_begin <= triangles[ti].x && triangles[ti].x < e.vertex_end)
 			    && (e.vertex_begin <= triangles[ti].y && triangles[ti].y < e.vertex_end)
 			    && (e.vertex_begin <= triangles[ti].z && triangles[ti].z < e.vertex_end) )) {
 				throw std::runtime_error("Invalid triangle in '" + filename + "'");
 			}
-			wm_triangles.emplace_back(
-				triangles[ti].x - e.vertex_begin,
-				triangles[ti].y - e.vertex_begin,
-				triangles[ti].z - e.vertex_begin
-			);
 		}
-		
-		std::string name(names.begin() + e.name_begin, names.begin() + e.name_end);
 
-		auto ret = meshes.emplace(name, WalkMesh(wm_vertices, wm_normals, wm_triangles));
-		if (!ret.second) {
-			throw std::runtime_error("WalkMesh with duplicated name '" + name + "' in '" + filename + "'");
+		entries.emplace_back();
+		entries.back().name = std::string(names + e.name_begin, names + e.name_end);
+		entries.back().vertex_begin = e.vertex_begin;
+		entries.back().vertex_end = e.vertex_end;
+		entries.back().triangle_begin = e.triangle_begin;
+		entries.back().triangle_end = e.triangle_end;
+	}
+}
+
+WalkMesh WalkMeshFile::make_walkmesh(uint32_t vertex_begin, uint32_t vertex_end, uint32_t triangle_begin, uint32_t triangle_end, uint32_t threads) const {
+	assert(vertex_begin <= vertex_end && vertex_end <= vertices.size());
+	assert(triangle_begin <= triangle_end && triangle_end <= triangles.size());
+
+	uint32_t count = vertex_end - vertex_begin;
+
+	//triangles in the file index the file's whole vertex array; the first walkmesh's (vertex_begin == 0) can be viewed in place:
+	if (vertex_begin == 0) {
+		return WalkMesh(
+			WalkMesh::View< glm::vec3 >(vertices.begin(), count),
+			WalkMesh::View< glm::vec3 >(normals.begin(), count),
+			WalkMesh::View< glm::uvec3 >(triangles.begin() + triangle_begin, triangle_end - triangle_begin),
+			file,
+			threads
+		);
+	}
+
+	//...other walkmeshes' triangles are copied, with indices made relative to vertex_begin:
+	// (viewing them in place would mean viewing vertices [0,vertex_end) -- and sizing per-vertex structures like
+	//  WalkMesh::half_edges_begin and CompactWalkMesh's arrays for all of them -- which costs more than this copy for all but the first few walkmeshes in a file)
+	struct RangeStorage {
+		std::shared_ptr< MappedFile > file;
+		std::vector< glm::uvec3 > triangles;
+	};
+	auto storage = std::make_shared< RangeStorage >();
+	storage->file = file;
+	storage->triangles.reserve(triangle_end - triangle_begin);
+	for (uint32_t ti = triangle_begin; ti < triangle_end; ++ti) {
+		storage->triangles.emplace_back(triangles[ti] - glm::uvec3(vertex_begin));
+	}
+
+	return WalkMesh(
+		WalkMesh::View< glm::vec3 >(vertices.begin() + vertex_begin, count),
+		WalkMesh::View< glm::vec3 >(normals.begin() + vertex_begin, count),
+		WalkMesh::View< glm::uvec3 >(storage->triangles),
+		storage,
+		threads
+	);
+}
+
+WalkMeshes::WalkMeshes(std::string const &filename) {
+	WalkMeshFile contents(filename);
+
+	for (auto const &e : contents.entries) {
+		WalkMesh wm = contents.make_walkmesh(e.vertex_begin, e.vertex_end, e.triangle_begin, e.triangle_end, std::max(1U, std::thread::hardware_concurrency()));
+
+		if (!wm.non_manifold_edges.empty()) {
+			std::cerr << "WARNING: walkmesh '" << e.name << "' in '" << filename << "' has " << wm.non_manifold_edges.size() << " non-manifold edge(s)" << std::endl;
 		}
 
+		auto ret = meshes.emplace(e.name, std::move(wm));
+		if (!ret.second) {
+			throw std::runtime_error("WalkMesh with duplicated name '" + e.name + "' in '" + filename + "'");
+		}
 	}
 }
 
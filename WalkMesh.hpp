@@ -1,11 +1,13 @@
 #pragma once
 
 #include <glm/glm.hpp>
-#include <glm/gtx/hash.hpp> //allows the use of 'uvec2' as an unordered_map key
 
 #include <vector>
 #include <string>
+#include <list>
+#include <cassert>
 #include <unordered_map>
+#include <memory>
 
 //"WalkPoint" represents location on the WalkMesh as barycentric coordinates on a triangle:
 struct WalkPoint {
@@ -18,22 +20,220 @@ struct WalkPoint {
 	WalkPoint() = default;
 };
 
+//"TriangleWalkPoint" is a more compact location on the WalkMesh (12 bytes rather than 24), for storing many agents:
+// it refers to its triangle directly, so walking can index per-triangle data without looking the triangle up.
+// (convert with WalkMesh::to_triangle_walk_point and WalkMesh::to_walk_point)
+struct TriangleWalkPoint {
+	//index of current triangle (in WalkMesh::triangles):
+	uint32_t triangle = -1U;
+	//barycentric coordinates of the triangle's first two vertices:
+	glm::vec2 weights = glm::vec2(std::numeric_limits< float >::quiet_NaN());
+	//barycentric coordinates of all three vertices:
+	// NOTE: the third weight is computed so that it is exactly 0.0 when weights.y == 1.0f - weights.x (so points on edges stay exactly on them)
+	glm::vec3 barycentric() const {
+		return glm::vec3(weights.x, weights.y, (1.0f - weights.x) - weights.y);
+	}
+	TriangleWalkPoint(uint32_t triangle_, glm::vec2 const &weights_) : triangle(triangle_), weights(weights_) { }
+	TriangleWalkPoint() = default;
+};
+
+//"WalkAgents" stores many walking agents in structure-of-arrays layout, for use with WalkMesh::walk_agents:
+struct WalkAgents {
+	//each agent's current triangle and barycentric coordinates (as in TriangleWalkPoint):
+	std::vector< uint32_t > triangle;
+	std::vector< float > weight_x, weight_y;
+	//step (in world space) each agent will take during the next walk_agents call:
+	// (walk_agents sets these to zero once the step is taken)
+	std::vector< float > step_x, step_y, step_z;
+
+	uint32_t size() const { return uint32_t(triangle.size()); }
+
+	//add an agent (with zero step) at a given location; returns index of the new agent:
+	uint32_t add(TriangleWalkPoint const &at);
+	//remove an agent by moving the last agent into its slot:
+	void remove(uint32_t i);
+
+	//convenience functions to convert to/from TriangleWalkPoints:
+	TriangleWalkPoint get(uint32_t i) const {
+		return TriangleWalkPoint(triangle[i], glm::vec2(weight_x[i], weight_y[i]));
+	}
+	void set(uint32_t i, TriangleWalkPoint const &at) {
+		triangle[i] = at.triangle;
+		weight_x[i] = at.weights.x; weight_y[i] = at.weights.y;
+	}
+	void set_step(uint32_t i, glm::vec3 const &step) {
+		step_x[i] = step.x; step_y[i] = step.y; step_z[i] = step.z;
+	}
+
+	//internals:
+	//per-thread working space for walk_agents (kept between calls to avoid reallocating every tick):
+	struct Scratch {
+		std::vector< uint8_t > edges; //edge each agent stopped at on the first iteration
+		std::vector< uint32_t > active; //agents that still have some step remaining
+	};
+	std::vector< Scratch > scratch;
+};
+
+//"WalkPathCache" remembers recently-found triangle corridors, for use with WalkMesh::find_path:
+// (corridors are keyed by start and goal triangle; least-recently-used corridors are forgotten first)
+// NOTE: not thread-safe; give each thread its own cache.
+struct WalkPathCache {
+	WalkPathCache(uint32_t capacity_ = 64) : capacity(capacity_) { }
+	uint32_t capacity;
+
+	//returns cached corridor from start_triangle to goal_triangle (marking it as recently used), or nullptr if not cached:
+	std::vector< uint32_t > const *find(uint32_t start_triangle, uint32_t goal_triangle);
+	//store a corridor (forgetting the least-recently-used corridor if over capacity):
+	void insert(uint32_t start_triangle, uint32_t goal_triangle, std::vector< uint32_t > const &corridor);
+	void clear();
+
+	//internals:
+	struct Entry {
+		uint64_t key;
+		std::vector< uint32_t > corridor;
+	};
+	std::list< Entry > entries; //most-recently-used first
+	std::unordered_map< uint64_t, std::list< Entry >::iterator > lookup;
+};
+
 struct WalkMesh {
+	//"View" refers to a (read-only) array stored elsewhere -- e.g., in a memory-mapped file, or in 'storage' below:
+	template< typename T >
+	struct View {
+		View() = default;
+		View(T const *data_, size_t count_) : data(data_), count(count_) { }
+		View(std::vector< T > const &from) : data(from.data()), count(from.size()) { }
+
+		T const &operator[](size_t i) const { assert(i < count); return data[i]; }
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+		T const *begin() const { return data; }
+		T const *end() const { return data + count; }
+
+		T const *data = nullptr;
+		size_t count = 0;
+	};
+
 	//Walk mesh will keep track of triangles, vertices:
-	std::vector< glm::vec3 > vertices;
-	std::vector< glm::vec3 > normals; //normals for interpolated 'up' direction
-	std::vector< glm::uvec3 > triangles; //CCW-oriented
+	View< glm::vec3 > vertices;
+	View< glm::vec3 > normals; //normals for interpolated 'up' direction
+	View< glm::uvec3 > triangles; //CCW-oriented
 
-	//This "next vertex" map includes [a,b]->c, [b,c]->a, and [c,a]->b for each triangle (a,b,c), and is useful for checking what's over an edge from a given point:
-	std::unordered_map< glm::uvec2, uint32_t > next_vertex;
+	//keeps the data viewed by vertices, normals, and triangles alive (shared by copies of this walkmesh):
+	std::shared_ptr< void const > storage;
 
-	//Construct new WalkMesh and build next_vertex structure:
-	WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::vec3 > const &normals_, std::vector< glm::uvec3 > const &triangles_);
+	//Half-edge adjacency, stored per-vertex in contiguous arrays:
+	// each triangle (a,b,c) contributes half-edges a->b, b->c, and c->a
+	// the half-edges leaving vertex v are half_edges[half_edges_begin[v]] .. half_edges[half_edges_begin[v+1]-1]
+	struct HalfEdge {
+		uint32_t to; //vertex at the end of the half-edge
+		uint32_t corner; //3 * (index of triangle containing the half-edge) + (position of the starting vertex in that triangle)
+	};
+	std::vector< uint32_t > half_edges_begin; //vertices.size() + 1 entries
+	std::vector< HalfEdge > half_edges; //3 * triangles.size() entries (sorted by 'to' within each vertex's range)
+
+	//half-edges (a,b) that appear in more than one triangle -- i.e., edges shared by three or more triangles, or shared by triangles with inconsistent winding:
+	// (these are reported rather than rejected; find_corner returns the first such triangle)
+	std::vector< glm::uvec2 > non_manifold_edges;
+
+	//Looks up the triangle that contains half-edge a->b, returning its 'corner' value (or -1U if there is no such triangle):
+	uint32_t find_corner(uint32_t a, uint32_t b) const {
+		for (uint32_t i = half_edges_begin[a]; i < half_edges_begin[a+1]; ++i) {
+			if (half_edges[i].to == b) return half_edges[i].corner;
+		}
+		return -1U;
+	}
+
+	//Looks up the triangle that contains half-edge a->b, returning its remaining vertex (or -1U if there is no such triangle):
+	// that is, the "next vertex" after [a,b] is c, after [b,c] is a, and after [c,a] is b for each triangle (a,b,c)
+	// (useful for checking what's over an edge from a given point)
+	uint32_t next_vertex(uint32_t a, uint32_t b) const {
+		uint32_t corner = find_corner(a, b);
+		if (corner == -1U) return -1U;
+		return triangles[corner / 3][(corner % 3 + 2) % 3];
+	}
+
+	//Returns the corner of the half-edge running the opposite way along the edge that starts at 'corner' (or -1U on a boundary):
+	// (disabled edges and edges into disabled triangles count as boundaries -- see set_edge_enabled / set_triangle_enabled)
+	uint32_t twin_corner(uint32_t corner) const {
+		return twins[corner];
+	}
+	std::vector< uint32_t > twins; //twin_corner() of every corner, kept up to date as edges and triangles are disabled and enabled
+
+	//Returns the index of the triangle a walkpoint is on:
+	uint32_t find_triangle(WalkPoint const &wp) const {
+		uint32_t corner = find_corner(wp.indices.x, wp.indices.y);
+		assert(corner != -1U && "walkpoint should be on a walkmesh triangle");
+		return corner / 3;
+	}
+
+	//Block or unblock parts of the walkmesh at runtime (e.g., doors, destructible cover), updating twins incrementally:
+	//  - a disabled edge is a boundary from both sides
+	//  - a disabled triangle can't be walked onto, and is skipped by nearest_walk_point and heights_at / height_at;
+	//    walkpoints already on it can still walk off
+	//  - disabling an edge and its triangles is tracked separately, so e.g. enabling a triangle leaves its disabled edges disabled
+	// NOTE: not safe to call while other threads are querying the walkmesh (e.g., during walk_agents);
+	//       flow fields and cached paths computed before a change don't see it
+	void set_edge_enabled(uint32_t a, uint32_t b, bool enabled); //edge between vertices a and b (either direction)
+	void set_triangle_enabled(uint32_t triangle, bool enabled);
+	bool is_triangle_enabled(uint32_t triangle) const {
+		return !triangle_disabled[triangle];
+	}
+	std::vector< uint8_t > edge_disabled; //per corner: was the edge starting at this corner disabled with set_edge_enabled?
+	std::vector< uint8_t > triangle_disabled; //per triangle: was this triangle disabled with set_triangle_enabled?
+	//recompute twins[] for all half-edges a->b and b->a:
+	void update_twins(uint32_t a, uint32_t b);
+
+	//Per-triangle data, precomputed so that walking doesn't need to re-derive it on each step:
+	struct TriangleData {
+		//gradient[i] is the (in-plane) world-space gradient of the barycentric weight of triangles[t][i]:
+		// (so a world-space step s changes the weights by ( dot(s,gradient[0]), dot(s,gradient[1]), dot(s,gradient[2]) ))
+		glm::vec3 gradient[3];
+		//inward[i] is the unit in-plane vector perpendicular to the edge opposite triangles[t][i], pointing into the triangle:
+		glm::vec3 inward[3];
+		//unit geometric normal of the triangle:
+		glm::vec3 normal;
+	};
+	std::vector< TriangleData > triangle_data; //one per triangle
+
+	//Bounding volume hierarchy over triangles (used to accelerate nearest_walk_point):
+	struct BVHNode {
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+		//if count == 0, node is interior and its children are bvh_nodes[first] and bvh_nodes[first+1]
+		//otherwise, node is a leaf holding triangles bvh_triangles[first] .. bvh_triangles[first+count-1]
+		uint32_t first = 0;
+		uint32_t count = 0;
+	};
+	std::vector< BVHNode > bvh_nodes; //bvh_nodes[0] is the root
+	std::vector< uint32_t > bvh_triangles; //indices into 'triangles', ordered so each leaf is a contiguous range
+
+	//2D (xy) grid of triangle buckets (used to accelerate heights_at / height_at):
+	// cell (x,y) covers grid_min + [x,x+1) * grid_cell_size by grid_min + [y,y+1) * grid_cell_size,
+	// and holds the triangles whose xy bounds touch it: grid_triangles[grid_cells_begin[c]] .. grid_triangles[grid_cells_begin[c+1]-1] for c = y * grid_size.x + x
+	// (triangles with no xy area, i.e., vertical walls, are left out)
+	glm::vec2 grid_min = glm::vec2(0.0f);
+	float grid_cell_size = 1.0f;
+	glm::uvec2 grid_size = glm::uvec2(0);
+	std::vector< uint32_t > grid_cells_begin; //grid_size.x * grid_size.y + 1 entries
+	std::vector< uint32_t > grid_triangles;
+
+	//Construct new WalkMesh and build half-edge, per-triangle, bvh, and grid structures:
+	//  - if storage_ is given, the walkmesh views the data it holds without copying
+	//  - otherwise, vertices/normals/triangles are copied into storage owned by the walkmesh
+	//  - if threads > 1, construction of large walkmeshes is split across that many threads
+	WalkMesh(View< glm::vec3 > vertices_, View< glm::vec3 > normals_, View< glm::uvec3 > triangles_, std::shared_ptr< void const > storage_ = nullptr, uint32_t threads = 1);
 
 	//used to initialize walking -- finds the closest point on the walk mesh:
-	// (should only need to call this at the start of a level)
+	// (uses the bvh, so takes roughly logarithmic time in the number of triangles)
 	WalkPoint nearest_walk_point(glm::vec3 const &world_point) const;
 
+	//closest point near a known walkpoint (e.g., to relocate an agent after knockback):
+	// walks outward from the hint's triangle to the closest point on the surrounding surface, which usually takes only a few triangles;
+	// falls back to the bvh (as above) if world_point is too far from the hint to reach by walking.
+	// NOTE: may differ from nearest_walk_point(world_point) if a separate surface (e.g., a floor above) is closer than the hint's surface
+	WalkPoint nearest_walk_point(glm::vec3 const &world_point, WalkPoint const &hint) const;
+
 
 	//take a step on a triangle, stopping at edges:
 	//  if the step stays within the triangle:
@@ -64,6 +264,93 @@ struct WalkMesh {
 		glm::quat *rotation     //[out] rotation over edge
 	) const;
 
+	//convert between WalkPoint and TriangleWalkPoint:
+	// (to_walk_point lists the triangle's vertices in order, so doesn't follow WalkPoint's edge convention)
+	TriangleWalkPoint to_triangle_walk_point(WalkPoint const &wp) const;
+	WalkPoint to_walk_point(TriangleWalkPoint const &twp) const {
+		return WalkPoint(triangles[twp.triangle], twp.barycentric());
+	}
+
+	//walk_in_triangle and cross_edge for TriangleWalkPoints, which need no triangle lookup or reordering of weights:
+	//  - *edge is the corner (as in HalfEdge) of the edge the step reached, or -1U if the step stayed within the triangle
+	//  - cross_edge takes that corner, and otherwise works as above
+	void walk_in_triangle(TriangleWalkPoint const &start, glm::vec3 const &step, TriangleWalkPoint *end, float *time, uint32_t *edge) const;
+	bool cross_edge(TriangleWalkPoint const &start, uint32_t edge, TriangleWalkPoint *end, glm::quat *rotation) const;
+
+	//bend a step that ran into a wall (an edge cross_edge can't cross) so that it slides along the wall:
+	//  - a step pointing into the wall bounces off of it; a step pointing along the wall is bent slightly away from it
+	//  - uses TriangleData::inward, so needs no normalization (every edge has one, since disabled edges are walls too)
+	//  - the wall is given by its corner (as reported by walk_in_triangle for TriangleWalkPoints) or by a walkpoint on edge at.indices.xy
+	glm::vec3 slide_along_wall(uint32_t edge, glm::vec3 const &step) const;
+	glm::vec3 slide_along_wall(WalkPoint const &at, glm::vec3 const &step) const;
+
+	//advance every agent by its step, crossing edges and sliding along walls as needed:
+	//  - uses the same iteration budget (10 triangles per agent) and wall-slide response as the player in PlayMode
+	//  - agent steps are zeroed once taken (any step left over after the iteration budget is kept for the next call)
+	//  - if threads > 1, large batches are split across that many worker threads
+	void walk_agents(WalkAgents &agents, uint32_t threads = 1) const;
+
+	//find a walking path from start to goal:
+	//  - runs A* over the triangle adjacency graph to find a corridor of triangles
+	//  - then pulls the path tight through the corridor (funnel algorithm, in the xy plane)
+	//  - *waypoints gets world-space points from start to goal (inclusive)
+	//  - if cache is given, corridors are looked up in / added to it, skipping repeated searches
+	//  - returns false (leaving *waypoints empty) if goal is not reachable from start
+	bool find_path(
+		WalkPoint const &start,          //[in] starting location
+		WalkPoint const &goal,           //[in] goal location
+		std::vector< glm::vec3 > *waypoints, //[out] path
+		WalkPathCache *cache = nullptr   //[in,out] optional corridor cache
+	) const;
+
+	//trace a straight line along the walkmesh surface (like walking, but stopping at walls rather than sliding along them):
+	//  - returns true if the whole step fits on the walkmesh (*end is the final location, *time is 1.0)
+	//  - returns false if a boundary edge was hit (*end is on that edge -- end->indices.xy -- and *time is the fraction of step taken)
+	//  - does not allocate, so is cheap enough for many queries per frame
+	bool raycast(
+		WalkPoint const &start, //[in] starting location
+		glm::vec3 const &step,  //[in] step to trace (in world space); follows the surface over edges, as with walking
+		WalkPoint *end,         //[out] where the trace stopped
+		float *time             //[out] fraction of step traced before stopping
+	) const;
+
+	//is the straight line from 'from' to 'to' (as seen from above, i.e., in the xy plane) entirely on the walkmesh?
+	// (traced through triangle adjacency; does not allocate)
+	bool line_of_sight(WalkPoint const &from, WalkPoint const &to) const;
+
+	//intersect an arbitrary world-space ray with the (enabled) walkmesh triangles (using the bvh):
+	//  - returns true and sets *hit and *distance (along direction, in units of |direction|) for the closest hit within max_distance
+	//  - returns false if the ray misses
+	//  - does not allocate
+	bool intersect_ray(
+		glm::vec3 const &origin,    //[in] ray start
+		glm::vec3 const &direction, //[in] ray direction
+		float max_distance,         //[in] ignore hits farther than this
+		WalkPoint *hit,             //[out] closest hit
+		float *distance             //[out] distance to closest hit
+	) const;
+
+	//walkmesh surface directly above or below an xy location (e.g., for spawning and placing objects on the ground):
+	struct HeightHit {
+		WalkPoint at;
+		float height; //z of the surface at 'at'
+	};
+
+	//find every surface at xy, using the grid:
+	//  - *hits gets one entry per surface, sorted from lowest to highest (more than one where layers overlap, e.g., bridges and upper floors)
+	//  - *hits is empty if xy is off the walkmesh
+	//  - does not allocate if *hits already has enough capacity
+	void heights_at(glm::vec2 const &xy, std::vector< HeightHit > *hits) const;
+
+	//find the surface an object at (xy, reference_height) would land on -- the highest one at or below reference_height or, if there is none, the lowest one above:
+	//  - pass reference_height = infinity for the topmost surface
+	//  - returns false if xy is off the walkmesh
+	//  - does not allocate
+	bool height_at(glm::vec2 const &xy, float reference_height, WalkPoint *at, float *height) const;
+
+	//A* search for a corridor of triangles (start_triangle .. goal_triangle, inclusive); returns false if none exists:
+	bool find_corridor(uint32_t start_triangle, uint32_t goal_triangle, std::vector< uint32_t > *corridor) const;
+
 	//used to read back results of walking:
 	glm::vec3 to_world_point(WalkPoint const &wp) const {
 		//if you were looking here for the lesson solution, well, here you go:
@@ -82,6 +369,14 @@ struct WalkMesh {
 		);
 	}
 
+	//as above, for TriangleWalkPoints:
+	glm::vec3 to_world_point(TriangleWalkPoint const &twp) const {
+		return to_world_point(to_walk_point(twp));
+	}
+	glm::vec3 to_world_smooth_normal(TriangleWalkPoint const &twp) const {
+		return to_world_smooth_normal(to_walk_point(twp));
+	}
+
 	//read back a triangle normal at a walkpoint:
 	glm::vec3 to_world_triangle_normal(WalkPoint const &wp) const {
 		glm::vec3 const &a = vertices[wp.indices.x];
@@ -92,8 +387,111 @@ struct WalkMesh {
 
 };
 
+//"CompactWalkMesh" is a quantized copy of a WalkMesh, for levels where walkmesh memory (and cache) footprint matters:
+//  - positions are stored as 16-bit fixed point within the bounding box of the vertices triangles use
+//  - normals are octahedral-encoded as two 16-bit values
+//  - triangle indices are stored in 16 bits if every index triangles use fits
+//  - triangles are stored in bvh order, so bvh leaves refer to them directly
+// Vertex indices are the same as in the source WalkMesh, so WalkPoints can be used with either.
+// (per-vertex arrays only cover the vertices from the first to the last one triangles use -- the "vertex count" below)
+// Walking decodes positions as it goes (rather than reading precomputed per-triangle data).
+struct CompactWalkMesh {
+	//build from a walkmesh (measuring accuracy against it):
+	CompactWalkMesh(WalkMesh const &walkmesh);
+
+	//per-vertex arrays start at vertex vertex_base (and stored triangle indices are relative to it):
+	uint32_t vertex_base = 0;
+	//quantized positions; vertex v is at position_min + position_scale * (positions[3i], positions[3i+1], positions[3i+2]), i = v - vertex_base:
+	glm::vec3 position_min = glm::vec3(0.0f);
+	glm::vec3 position_scale = glm::vec3(0.0f);
+	std::vector< uint16_t > positions; //3 per vertex
+	//octahedral-encoded normal directions (signed normalized):
+	// NOTE: only direction is kept, so to_world_smooth_normal weights vertex normals equally even if the source's normals weren't unit length
+	std::vector< int16_t > normals; //2 per vertex
+	//triangle vertex indices, by corner (3 * triangle + position in triangle); only one of these is non-empty:
+	std::vector< uint16_t > indices16;
+	std::vector< uint32_t > indices32;
+	//corners (as above) of triangles' half-edges, grouped by starting vertex, as in WalkMesh::half_edges:
+	std::vector< uint32_t > corners_begin; //vertex count + 1 entries
+	std::vector< uint32_t > corners; //3 * triangle count entries
+	//bounding volume hierarchy (leaves hold triangles first .. first+count-1, and bounds are padded by the quantization step):
+	std::vector< WalkMesh::BVHNode > bvh_nodes;
+
+	//error relative to the source walkmesh (measured at construction):
+	struct Accuracy {
+		float max_position_error = 0.0f; //world units
+		float max_normal_error = 0.0f; //radians
+	} accuracy;
+
+	glm::vec3 position(uint32_t v) const {
+		uint32_t i = v - vertex_base;
+		return position_min + position_scale * glm::vec3(positions[3*i+0], positions[3*i+1], positions[3*i+2]);
+	}
+	glm::vec3 normal(uint32_t v) const;
+	uint32_t index(uint32_t corner) const {
+		return vertex_base + (indices16.empty() ? indices32[corner] : indices16[corner]);
+	}
+
+	//as in WalkMesh:
+	uint32_t find_corner(uint32_t a, uint32_t b) const {
+		for (uint32_t i = corners_begin[a - vertex_base]; i < corners_begin[a - vertex_base + 1]; ++i) {
+			uint32_t c = corners[i];
+			if (index(c % 3 == 2 ? c - 2 : c + 1) == b) return c;
+		}
+		return -1U;
+	}
+	WalkPoint nearest_walk_point(glm::vec3 const &world_point) const;
+	void walk_in_triangle(WalkPoint const &start, glm::vec3 const &step, WalkPoint *end, float *time) const;
+	bool cross_edge(WalkPoint const &start, WalkPoint *end, glm::quat *rotation) const;
+
+	glm::vec3 to_world_point(WalkPoint const &wp) const {
+		return wp.weights.x * position(wp.indices.x)
+		     + wp.weights.y * position(wp.indices.y)
+		     + wp.weights.z * position(wp.indices.z);
+	}
+	glm::vec3 to_world_smooth_normal(WalkPoint const &wp) const {
+		return glm::normalize(
+			  wp.weights.x * normal(wp.indices.x)
+			+ wp.weights.y * normal(wp.indices.y)
+			+ wp.weights.z * normal(wp.indices.z)
+		);
+	}
+	glm::vec3 to_world_triangle_normal(WalkPoint const &wp) const {
+		glm::vec3 a = position(wp.indices.x);
+		glm::vec3 b = position(wp.indices.y);
+		glm::vec3 c = position(wp.indices.z);
+		return glm::normalize( glm::cross( b-a, c-a ) );
+	}
+};
+
+struct MappedFile;
+
+//"WalkMeshFile" finds the walkmeshes in a (memory-mapped) walkmesh file, checking that the file is well-formed:
+// (used by WalkMeshes and TiledWalkMesh)
+struct WalkMeshFile {
+	WalkMeshFile(std::string const &filename);
+
+	std::shared_ptr< MappedFile > file;
+	//data for all walkmeshes in the file (triangles index the whole vertices array):
+	WalkMesh::View< glm::vec3 > vertices;
+	WalkMesh::View< glm::vec3 > normals;
+	WalkMesh::View< glm::uvec3 > triangles;
+	//each walkmesh's name, vertex range, and triangle range:
+	struct Entry {
+		std::string name;
+		uint32_t vertex_begin, vertex_end;
+		uint32_t triangle_begin, triangle_end;
+	};
+	std::vector< Entry > entries;
+
+	//make a walkmesh from vertices [vertex_begin,vertex_end) and triangles [triangle_begin,triangle_end):
+	// vertices and normals are viewed in place; triangles are too if vertex_begin is 0, and otherwise are copied, with indices made relative to vertex_begin
+	WalkMesh make_walkmesh(uint32_t vertex_begin, uint32_t vertex_end, uint32_t triangle_begin, uint32_t triangle_end, uint32_t threads = 1) const;
+};
+
 struct WalkMeshes {
 	//load a list of named WalkMeshes from a file:
+	// (the file is memory-mapped, and its vertex/normal data is used in place rather than copied, as are the first walkmesh's triangles -- see WalkMeshFile::make_walkmesh)
 	WalkMeshes(std::string const &filename);
 
 	//retrieve a WalkMesh by name:
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+//Read-only memory mapping of a whole file; throws on error:
+// (the mapping stays valid for the lifetime of the MappedFile)
+struct MappedFile {
+	MappedFile(std::string const &filename);
+	~MappedFile();
+
+	//mappings can't be copied:
+	MappedFile(MappedFile const &) = delete;
+	MappedFile &operator=(MappedFile const &) = delete;
+
+	char const *data = nullptr;
+	size_t size = 0;
+
+	//internals (os-specific handles):
+	void *file = nullptr;
+	void *mapping = nullptr;
+};
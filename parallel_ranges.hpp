@@ -0,0 +1,29 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+//helper that splits work on [0,count) between threads:
+// runs f(thread, begin, end) on contiguous ranges, one per thread (up to 'threads' threads, each getting at least one item)
+// with one thread (or one item), f runs on the calling thread; otherwise, returns once every thread is done
+
+template< typename F >
+void parallel_ranges(uint32_t threads, uint32_t count, F const &f) {
+	threads = std::max(1U, std::min(threads, count));
+	if (threads == 1) {
+		f(0, 0, count);
+		return;
+	}
+	std::vector< std::thread > workers;
+	workers.reserve(threads);
+	for (uint32_t t = 0; t < threads; ++t) {
+		uint32_t begin = uint32_t(uint64_t(count) * t / threads);
+		uint32_t end = uint32_t(uint64_t(count) * (t + 1) / threads);
+		workers.emplace_back([&f, t, begin, end](){ f(t, begin, end); });
+	}
+	for (auto &w : workers) {
+		w.join();
+	}
+}
@@ -4,6 +4,8 @@
 #include <vector>
 #include <stdexcept>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 
 //helper function that reads an array of structures preceded by a simple header:
 //Expected format:
@@ -63,3 +65,46 @@ void write_chunk(std::string const &magic, std::vector< T > const &from, std::os
 	to.write(reinterpret_cast< const char * >(&header), sizeof(header));
 	to.write(reinterpret_cast< const char * >(from.data()), from.size() * sizeof(T));
 }
+
+
+//helper function that finds a chunk (in the same format as read_chunk) in memory, without copying it:
+// *at_ is advanced past the chunk; throws if the chunk is malformed or its data isn't suitably aligned for T
+template< typename T >
+void view_chunk(char const **at_, char const *end, std::string const &magic, T const **data_, size_t *count_) {
+	assert(at_);
+	auto &at = *at_;
+	assert(data_);
+	auto &data = *data_;
+	assert(count_);
+	auto &count = *count_;
+
+	struct ChunkHeader {
+		char magic[4] = {'\0', '\0', '\0', '\0'};
+		uint32_t size = 0;
+	};
+	static_assert(sizeof(ChunkHeader) == 8, "header is packed");
+
+	ChunkHeader header;
+	if (size_t(end - at) < sizeof(header)) {
+		throw std::runtime_error("Failed to read chunk header");
+	}
+	std::memcpy(&header, at, sizeof(header));
+	at += sizeof(header);
+	if (std::string(header.magic,4) != magic) {
+		throw std::runtime_error("Unexpected magic number in chunk");
+	}
+
+	if (header.size % sizeof(T) != 0) {
+		throw std::runtime_error("Size of chunk not divisible by element size");
+	}
+	if (size_t(end - at) < header.size) {
+		throw std::runtime_error("Failed to read chunk data.");
+	}
+	if (reinterpret_cast< uintptr_t >(at) % alignof(T) != 0) {
+		throw std::runtime_error("Chunk data is not aligned.");
+	}
+
+	data = reinterpret_cast< T const * >(at);
+	count = header.size / sizeof(T);
+	at += header.size;
+}
@@ -12,8 +12,16 @@ for i in range(0,len(sys.argv)):
 	if sys.argv[i] == '--':
 		args = sys.argv[i+1:]
 
+#optional tiling: --tile=<size> cuts each walkmesh into <size> x <size> (xy) tiles, for use with TiledWalkMesh:
+tile_size = None
+for arg in list(args):
+	if arg.startswith('--tile='):
+		tile_size = float(arg[len('--tile='):])
+		assert(tile_size > 0.0)
+		args.remove(arg)
+
 if len(args) < 2 or len(args) > 3:
-	print("\n\nUsage:\nblender --background --python export-walkmeshes.py -- <infile.blend>[:collection] [pattern] <outfile.w>\nExports the meshes with names matching regex /pattern/ (default /.*/) referenced by all objects in collection to a binary blob, in walkmesh format, indexed by the names of the objects that reference them.\n")
+	print("\n\nUsage:\nblender --background --python export-walkmeshes.py -- [--tile=<size>] <infile.blend>[:collection] [pattern] <outfile.w>\nExports the meshes with names matching regex /pattern/ (default /.*/) referenced by all objects in collection to a binary blob, in walkmesh format, indexed by the names of the objects that reference them.\nWith --tile=<size>, each mesh is instead written as tiles named 'name@x,y' holding the triangles with centroids in [x,x+1)*size by [y,y+1)*size.\n")
 	exit(1)
 
 infile = args[0]
@@ -44,6 +52,7 @@ print(" of '" + infile + "', matching pattern /" + pattern + "/ to '" + outfile
 import bpy
 import struct
 import re
+import math
 
 bpy.ops.wm.open_mainfile(filepath=infile)
 
@@ -104,40 +113,9 @@ position_count = 0
 normal_count = 0
 triangle_count = 0
 
-for obj in bpy.data.objects:
-	if obj.data in to_write:
-		to_write.remove(obj.data)
-	else:
-		continue
-
-	obj.hide_select = False
-	mesh = obj.data
-	name = mesh.name
-
-	print("Writing '" + name + "'...")
-
-	if bpy.context.object:
-		bpy.ops.object.mode_set(mode='OBJECT') #get out of edit mode (just in case)
-
-	#select the object and make it the active object:
-	bpy.ops.object.select_all(action='DESELECT')
-	obj.select_set(True)
-	bpy.context.view_layer.objects.active = obj
-	bpy.ops.object.mode_set(mode='OBJECT')
-
-	#print(obj.visible_get()) #DEBUG
-
-	#apply all modifiers (?):
-	bpy.ops.object.convert(target='MESH')
-
-	#subdivide object's mesh into triangles:
-	bpy.ops.object.mode_set(mode='EDIT')
-	bpy.ops.mesh.select_all(action='SELECT')
-	bpy.ops.mesh.quads_convert_to_tris(quad_method='BEAUTY', ngon_method='BEAUTY')
-	bpy.ops.object.mode_set(mode='OBJECT')
-
-	#compute normals (respecting face smoothing):
-	mesh.calc_normals_split()
+def write_walkmesh(mesh, name, polys):
+	global positions, normals, triangles, strings, index
+	global position_count, normal_count, triangle_count
 
 	#store the beginning indices:
 	vertex_begin = position_count
@@ -148,7 +126,7 @@ for obj in bpy.data.objects:
 	vertex_inds = dict() #for each referenced vertex, store new index
 	vertex_normals = [] #for each referenced vertex, store list of normals
 	def write_vertex(index, normal):
-		global positions, position_count, vertex_refs, vertex_normals
+		global positions, position_count
 		if index not in vertex_inds:
 			vertex_inds[index] = len(vertex_inds)
 			vertex_normals.append([])
@@ -157,8 +135,8 @@ for obj in bpy.data.objects:
 		vertex_normals[vertex_inds[index]].append(normal)
 		return struct.pack('I', vertex_begin + vertex_inds[index])
 
-	#write the mesh triangles:
-	for poly in mesh.polygons:
+	#write the triangles (only the vertices they reference get written):
+	for poly in polys:
 		assert(len(poly.loop_indices) == 3)
 
 		#check that faces are CCW-oriented:
@@ -202,6 +180,55 @@ for obj in bpy.data.objects:
 	index += struct.pack('II', vertex_begin, vertex_end)
 	index += struct.pack('II', triangle_begin, triangle_end)
 
+for obj in bpy.data.objects:
+	if obj.data in to_write:
+		to_write.remove(obj.data)
+	else:
+		continue
+
+	obj.hide_select = False
+	mesh = obj.data
+	name = mesh.name
+
+	print("Writing '" + name + "'...")
+
+	if bpy.context.object:
+		bpy.ops.object.mode_set(mode='OBJECT') #get out of edit mode (just in case)
+
+	#select the object and make it the active object:
+	bpy.ops.object.select_all(action='DESELECT')
+	obj.select_set(True)
+	bpy.context.view_layer.objects.active = obj
+	bpy.ops.object.mode_set(mode='OBJECT')
+
+	#print(obj.visible_get()) #DEBUG
+
+	#apply all modifiers (?):
+	bpy.ops.object.convert(target='MESH')
+
+	#subdivide object's mesh into triangles:
+	bpy.ops.object.mode_set(mode='EDIT')
+	bpy.ops.mesh.select_all(action='SELECT')
+	bpy.ops.mesh.quads_convert_to_tris(quad_method='BEAUTY', ngon_method='BEAUTY')
+	bpy.ops.object.mode_set(mode='OBJECT')
+
+	#compute normals (respecting face smoothing):
+	mesh.calc_normals_split()
+
+	#write the mesh triangles (as one walkmesh, or as tiles):
+	if tile_size == None:
+		write_walkmesh(mesh, name, mesh.polygons)
+	else:
+		tiles = dict()
+		for poly in mesh.polygons:
+			centroid = (mesh.vertices[poly.vertices[0]].co + mesh.vertices[poly.vertices[1]].co + mesh.vertices[poly.vertices[2]].co) / 3.0
+			tile = (math.floor(centroid.x / tile_size), math.floor(centroid.y / tile_size))
+			if tile not in tiles: tiles[tile] = []
+			tiles[tile].append(poly)
+		for tile in sorted(tiles.keys()):
+			write_walkmesh(mesh, name + "@" + str(tile[0]) + "," + str(tile[1]), tiles[tile])
+		print("  (as " + str(len(tiles)) + " tiles)")
+
 
 #check that we wrote as much data as anticipated:
 assert(position_count * 3*4 == len(positions))
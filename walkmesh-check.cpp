@@ -0,0 +1,144 @@
+#include "WalkMesh.hpp"
+
+#include <glm/gtx/norm.hpp>
+
+#include <iostream>
+#include <random>
+#include <string>
+
+//This program checks that WalkMesh::nearest_walk_point (which uses the bvh) finds the same point as a scan over every triangle.
+// usage: walkmesh-check file.w [queries per walkmesh]
+
+//barycentric weights of the projection of pt into the plane of triangle a,b,c:
+static glm::vec3 plane_weights(glm::vec3 const &a, glm::vec3 const &b, glm::vec3 const &c, glm::vec3 const &pt) {
+	glm::vec3 u = b - a;
+	glm::vec3 v = c - a;
+	glm::vec3 n = glm::cross(u, v);
+	glm::vec3 d = pt - a;
+	float ndot = glm::dot(n, n);
+	float z = glm::dot(glm::cross(u, d), n) / ndot;
+	float y = glm::dot(n, glm::cross(d, v)) / ndot;
+	return glm::vec3(1.0f - z - y, y, z);
+}
+
+//brute-force reference: closest point on any enabled triangle, scanning front-to-back (so ties go to the lowest triangle index):
+static WalkPoint nearest_by_scan(WalkMesh const &wm, glm::vec3 const &world_point) {
+	WalkPoint closest;
+	float closest_dis2 = std::numeric_limits< float >::infinity();
+
+	for (uint32_t ti = 0; ti < wm.triangles.size(); ++ti) {
+		if (!wm.is_triangle_enabled(ti)) continue;
+		glm::uvec3 const &tri = wm.triangles[ti];
+		glm::vec3 const &a = wm.vertices[tri.x];
+		glm::vec3 const &b = wm.vertices[tri.y];
+		glm::vec3 const &c = wm.vertices[tri.z];
+
+		//is the projection of world_point into the plane of (a,b,c) inside the triangle?
+		glm::vec3 coords = plane_weights(a,b,c, world_point);
+		if (coords.x >= 0.0f && coords.y >= 0.0f && coords.z >= 0.0f) {
+			float dis2 = glm::length2(world_point - (coords.x * a + coords.y * b + coords.z * c));
+			if (dis2 < closest_dis2) {
+				closest_dis2 = dis2;
+				closest = WalkPoint(tri, coords);
+			}
+			continue;
+		}
+
+		//otherwise, the closest point is on an edge:
+		auto check_edge = [&](uint32_t ai, uint32_t bi, uint32_t ci) {
+			glm::vec3 const &a = wm.vertices[ai];
+			glm::vec3 const &b = wm.vertices[bi];
+			float along = glm::dot(world_point-a, b-a);
+			float max = glm::dot(b-a, b-a);
+			float amt = (along < 0.0f ? 0.0f : (along > max ? 1.0f : along / max));
+			glm::vec3 pt = (amt == 0.0f ? a : (amt == 1.0f ? b : glm::mix(a, b, amt)));
+			float dis2 = glm::length2(world_point - pt);
+			if (dis2 < closest_dis2) {
+				closest_dis2 = dis2;
+				closest = WalkPoint(glm::uvec3(ai, bi, ci), glm::vec3(1.0f - amt, amt, 0.0f));
+			}
+		};
+		check_edge(tri.x, tri.y, tri.z);
+		check_edge(tri.y, tri.z, tri.x);
+		check_edge(tri.z, tri.x, tri.y);
+	}
+	return closest;
+}
+
+//compare nearest_walk_point against nearest_by_scan at random points around the walkmesh; returns number of mismatches:
+static uint32_t check_walkmesh(std::string const &name, WalkMesh const &wm, uint32_t queries, std::mt19937 &mt) {
+	//query points are drawn from the bounding box of the mesh, grown by half its size in each direction:
+	glm::vec3 min = wm.bvh_nodes[0].min;
+	glm::vec3 max = wm.bvh_nodes[0].max;
+	glm::vec3 pad = 0.5f * (max - min) + glm::vec3(1.0f);
+	std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+
+	uint32_t mismatches = 0;
+	float max_dis_error = 0.0f;
+	for (uint32_t q = 0; q < queries; ++q) {
+		glm::vec3 pt = (min - pad) + (max - min + 2.0f * pad) * glm::vec3(unit(mt), unit(mt), unit(mt));
+
+		WalkPoint bvh = wm.nearest_walk_point(pt);
+		WalkPoint scan = nearest_by_scan(wm, pt);
+
+		float bvh_dis = glm::length(wm.to_world_point(bvh) - pt);
+		float scan_dis = glm::length(wm.to_world_point(scan) - pt);
+		float dis_error = std::abs(bvh_dis - scan_dis);
+		max_dis_error = std::max(max_dis_error, dis_error);
+
+		//same triangle (in the same order) and same weights, or -- if two triangles are equally close -- the same point:
+		bool same_place = (bvh.indices == scan.indices && glm::length(bvh.weights - scan.weights) <= 1e-5f);
+		bool same_point = (glm::length(wm.to_world_point(bvh) - wm.to_world_point(scan)) <= 1e-4f);
+		if (dis_error > 1e-4f || !(same_place || same_point)) {
+			if (mismatches < 10) {
+				std::cerr << "  MISMATCH at " << pt.x << " " << pt.y << " " << pt.z << ":"
+				          << " bvh distance " << bvh_dis << " weights " << bvh.weights.x << " " << bvh.weights.y << " " << bvh.weights.z
+				          << ", scan distance " << scan_dis << " weights " << scan.weights.x << " " << scan.weights.y << " " << scan.weights.z << std::endl;
+			}
+			mismatches += 1;
+		}
+	}
+
+	std::cout << "'" << name << "' (" << wm.triangles.size() << " triangles): " << queries << " queries, "
+	          << mismatches << " mismatches, max distance difference " << max_dis_error << std::endl;
+	return mismatches;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2 || argc > 3) {
+		std::cerr << "Usage:\n\t" << argv[0] << " file.w [queries per walkmesh]" << std::endl;
+		return 1;
+	}
+	std::string filename = argv[1];
+	uint32_t queries = (argc == 3 ? uint32_t(std::stoul(argv[2])) : 10000);
+
+	std::mt19937 mt(0x15466);
+	uint32_t mismatches = 0;
+
+	WalkMeshFile contents(filename);
+	WalkMeshes walkmeshes(filename);
+	for (auto const &e : contents.entries) {
+		WalkMesh const &wm = walkmeshes.lookup(e.name);
+		if (wm.triangles.empty()) continue;
+		mismatches += check_walkmesh(e.name, wm, queries, mt);
+
+		//again, with some triangles disabled (both paths should skip them):
+		WalkMesh partial = wm;
+		std::uniform_int_distribution< uint32_t > pick(0, uint32_t(partial.triangles.size()) - 1);
+		for (uint32_t i = 0; i < partial.triangles.size() / 10; ++i) {
+			partial.set_triangle_enabled(pick(mt), false);
+		}
+		bool any_enabled = false;
+		for (uint32_t ti = 0; ti < partial.triangles.size(); ++ti) {
+			if (partial.is_triangle_enabled(ti)) any_enabled = true;
+		}
+		if (any_enabled) mismatches += check_walkmesh(e.name + " (10% disabled)", partial, queries, mt);
+	}
+
+	if (mismatches != 0) {
+		std::cerr << "FAILED: " << mismatches << " mismatches." << std::endl;
+		return 1;
+	}
+	std::cout << "OK" << std::endl;
+	return 0;
+}